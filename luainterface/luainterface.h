@@ -12,7 +12,7 @@
 #ifndef LUAINTERFACE_H
 #define LUAINTERFACE_H
 
-#include <boost/tuple/tuple.hpp>
+#include <boost/atomic.hpp>
 #include <boost/cstdint.hpp>
 #include <boost/shared_ptr.hpp>
 
@@ -26,6 +26,7 @@
 #include <map>
 #include <vector>
 #include <string>
+#include <new>
 
 #include <stdio.h>
 #include <string.h>
@@ -93,28 +94,78 @@ struct BaseToParent<Base> \
 
 namespace Private
 {
-typedef boost::tuple<void*, std::vector<boost::uint32_t> > tuple;
+// bit set with one bit per registered type
+typedef boost::uint64_t lineage;
+
+// tags userdata created by luaT_push
+static const boost::uint32_t USERDATA_MAGIC = 0x4c756154;
+
+// Layout of every object userdata. The shared pointer lives inside the Lua
+// allocation so pushing an object costs a single allocation. The lineage
+// holds the bit of the pushed type and of each of its parents and is
+// cleared once the object has been collected.
+struct UserDataHeader
+{
+  boost::uint32_t magic;
+  lineage bits;
+};
+
+template <typename T>
+struct UserData
+{
+  UserDataHeader header;
+  boost::shared_ptr<T> ptr;
+};
+
+inline int next_type_id()
+{
+  static boost::atomic<int> count(0);
+  const int id = count++;
+
+  if (id >= 64)
+  {
+    fprintf(stderr, "LuaInterface: more than 64 types registered\n");
+  }
+
+  return id;
 }
 
+// bit identifying a type, ids are handed out on first use
 template <typename T>
-inline boost::shared_ptr<T> luaT_to(lua_State* L, int idx)
+inline lineage type_bit()
 {
-  typedef typename LuaInterface::BaseToInterface<T>::type interface;
+  static const int id = next_type_id();
+  return id < 64 ? lineage(1) << id : 0;
+}
 
-  Private::tuple** tuple_ptr_ptr = (Private::tuple**)lua_touserdata(L, idx);
+// test if the userdata at idx holds the type owning bit, or a child of it
+inline UserDataHeader* luaT_header(lua_State* L, int idx, lineage bit)
+{
+  UserDataHeader* header = (UserDataHeader*)lua_touserdata(L, idx);
 
-  if (tuple_ptr_ptr && *tuple_ptr_ptr)
+  // light userdata report a length of zero
+  if (header &&
+      lua_rawlen(L, idx) >= sizeof(UserDataHeader) &&
+      header->magic == USERDATA_MAGIC &&
+      (header->bits & bit))
   {
-    size_t n = (*tuple_ptr_ptr)->get<1>().size();
-    const boost::uint32_t hash = interface::hash();
-    for (size_t i = 0; i < n; i++)
-    {
-      if ((*tuple_ptr_ptr)->get<1>().at(i) == hash)
-      {
-        return boost::shared_ptr<T>(*(boost::shared_ptr<T>*)
-                                    (*tuple_ptr_ptr)->get<0>());
-      }
-    }
+    return header;
+  }
+
+  return 0;
+}
+}  // namespace Private
+
+template <typename T>
+inline boost::shared_ptr<T> luaT_to(lua_State* L, int idx)
+{
+  Private::UserDataHeader* header =
+      Private::luaT_header(L, idx, Private::type_bit<T>());
+
+  if (header)
+  {
+    // objects are stored as the pushed type, parents share its layout
+    return ((Private::UserData<T>*)header)->ptr;
   }
 
   return boost::shared_ptr<T>();
@@ -131,25 +182,31 @@ inline void luaT_addMethods(lua_State* L, std::vector<luaL_Reg> methods);
 template <typename T>
 struct fetch_lineage
 {
-  static void exec(std::vector<boost::uint32_t>& lineage)
+  static lineage exec()
   {
-    typedef typename LuaInterface::BaseToInterface<T>::type interface;
     typedef typename LuaInterface::BaseToParent<T>::type parent;
 
-    lineage.push_back(interface::hash());
-
-    fetch_lineage<parent>::exec(lineage);
+    return type_bit<T>() | fetch_lineage<parent>::exec();
   }
 };
 
 template <>
 struct fetch_lineage<void>
 {
-  static void exec(std::vector<boost::uint32_t>& )
+  static lineage exec()
   {
+    return 0;
   }
 };
 
+// lineage of a type, built once and shared by every pushed object
+template <typename T>
+inline lineage get_lineage()
+{
+  static const lineage bits = fetch_lineage<T>::exec();
+  return bits;
+}
+
 // push metatable on the stack
 template<class T>
 int luaT_mt(lua_State* L)
@@ -237,14 +294,12 @@ int luaT_tostring(lua_State* L)
 template<class T>
 int luaT_gc(lua_State* L)
 {
-  tuple** tuple_ptr_ptr = (Private::tuple**)lua_touserdata(L, 1);
+  UserData<T>* ud = (UserData<T>*)lua_touserdata(L, 1);
 
-  if (tuple_ptr_ptr && *tuple_ptr_ptr)
+  if (ud && ud->header.magic == USERDATA_MAGIC && ud->header.bits)
   {
-    boost::shared_ptr<T>* sp = (boost::shared_ptr<T>*)
-        (*tuple_ptr_ptr)->get<0>();
-    delete sp;
-    delete *tuple_ptr_ptr;
+    ud->ptr.~shared_ptr<T>();
+    ud->header.bits = 0;
   }
 
   return 0;
@@ -304,19 +359,14 @@ inline int luaT_push(lua_State* L, const boost::shared_ptr<T>& ptr)
   }
   else
   {
-    Private::tuple** tuple_ptr_ptr =
-        (Private::tuple**)lua_newuserdata(L, sizeof(Private::tuple*));
+    Private::UserData<T>* ud =
+        (Private::UserData<T>*)lua_newuserdata(L, sizeof(Private::UserData<T>));
 
-    // initialize the data
-    (*tuple_ptr_ptr) = new Private::tuple();
-
-    boost::shared_ptr<T>* sp = new boost::shared_ptr<T>(ptr);
-    (*tuple_ptr_ptr)->get<0>() = sp;
-
-    std::vector<boost::uint32_t> lineage;
-    Private::fetch_lineage<T>::exec(lineage);
-
-    (*tuple_ptr_ptr)->get<1>() = lineage;
+    // construct in place, released by luaT_gc
+    ud->header.magic = Private::USERDATA_MAGIC;
+    ud->header.bits = 0;
+    new (&ud->ptr) boost::shared_ptr<T>(ptr);
+    ud->header.bits = Private::get_lineage<T>();
 
     luaL_getmetatable(L, interface::typeName().c_str());
 
@@ -330,24 +380,7 @@ inline int luaT_push(lua_State* L, const boost::shared_ptr<T>& ptr)
 template<typename T>
 inline int luaT_is(lua_State* L, int idx)
 {
-  typedef typename LuaInterface::BaseToInterface<T>::type interface;
-
-  Private::tuple** tuple_ptr_ptr = (Private::tuple**)lua_touserdata(L, idx);
-
-  if (tuple_ptr_ptr && *tuple_ptr_ptr)
-  {
-    size_t n = (*tuple_ptr_ptr)->get<1>().size();
-    const boost::uint32_t hash = interface::hash();
-    for (size_t i = 0; i < n; i++)
-    {
-      if ((*tuple_ptr_ptr)->get<1>().at(i) == hash)
-      {
-        return 1;
-      }
-    }
-  }
-
-  return 0;
+  return Private::luaT_header(L, idx, Private::type_bit<T>()) ? 1 : 0;
 }
 
 inline int luaL_dostringn(lua_State* L, const char* code, const char* name)
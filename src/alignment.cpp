@@ -0,0 +1,677 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      alignment.cpp
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include "alignment.h"
+#include "threadpool.h"
+#include <dlib/optimization.h>
+#include <dlib/optimization/find_optimal_parameters.h>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+Alignment::Alignment(AtomContainer::Ptr a, AtomContainer::Ptr b)
+  : a_(a), b_(b)
+{
+  a_tree_ = a_->kdTree();
+  b_tree_ = b_->kdTree();
+}
+
+void Alignment::useDistanceField(double spacing, double margin)
+{
+  if (spacing > 0)
+  {
+    a_field_ = a_->distanceField(spacing, margin);
+    b_field_ = b_->distanceField(spacing, margin);
+  }
+  else
+  {
+    a_field_.reset();
+    b_field_.reset();
+  }
+}
+
+void Alignment::useReferenceField(double spacing, double margin)
+{
+  a_field_.reset();
+  b_field_.reset();
+
+  if (spacing > 0)
+  {
+    b_field_ = b_->distanceField(spacing, margin);
+  }
+}
+
+double Alignment::objective(const Params& X) const
+{
+  Matrix::Mat3 R;
+  Matrix::makeRotation(R, X(3), X(4), X(5));
+
+  const double zero[3] = {0, 0, 0};
+  const double d[3] = {X(0), X(1), X(2)};
+
+  if (b_field_)
+  {
+    const double ab = fieldSum(*a_, *b_field_, R, zero, d);
+
+    // without a field for a the b -> a half stays an exact search
+    const Matrix::Mat3 RT = dlib::trans(R);
+    const double ba = a_field_ ? fieldSum(*b_, *a_field_, RT, d, zero)
+                               : closestSum(*b_, *a_tree_, RT, d, zero);
+
+    return ab + ba;
+  }
+
+  // a -> b: move a with R * a + d and search b
+  const double ab = closestSum(*a_, *b_tree_, R, zero, d);
+
+  // b -> a: searched in the frame of a with R^T * (b - d) so the tree of a
+  // can be reused, rigid transforms preserve the distances
+  const Matrix::Mat3 RT = dlib::trans(R);
+  const double ba = closestSum(*b_, *a_tree_, RT, d, zero);
+
+  return ab + ba;
+}
+
+double Alignment::objective(const Params& X, Params& grad) const
+{
+  Matrix::Mat3 R;
+  Matrix::Mat3 dR[3];
+  Matrix::makeRotation(R, X(3), X(4), X(5));
+  Matrix::makeRotationDerivatives(dR, X(3), X(4), X(5));
+
+  const double zero[3] = {0, 0, 0};
+  const double d[3] = {X(0), X(1), X(2)};
+
+  // a -> b: residuals R * a + d - b
+  Matrix::Vec3 e_ab;
+  Matrix::Mat3 n_ab;
+  const double ab = closestSum(*a_, *b_, *b_tree_, R, zero, d, e_ab, n_ab);
+
+  // b -> a: residuals R^T * (b - d) - a
+  const Matrix::Mat3 RT = dlib::trans(R);
+  Matrix::Vec3 e_ba;
+  Matrix::Mat3 n_ba;
+  const double ba = closestSum(*b_, *a_, *a_tree_, RT, d, zero, e_ba, n_ba);
+
+  const Matrix::Vec3 gd = 2.0 * (e_ab - R * e_ba);
+
+  // d/dr of |R^T q - a|^2 contracts dR^T with e * q^T, i.e. dR with its
+  // transpose
+  const Matrix::Mat3 n = n_ab + dlib::trans(n_ba);
+
+  grad.set_size(6);
+
+  for (int k = 0; k < 3; k++)
+  {
+    grad(k) = gd(k);
+    grad(k + 3) = 2 * dlib::sum(dlib::pointwise_multiply(dR[k], n));
+  }
+
+  return ab + ba;
+}
+
+namespace
+{
+// dlib asks for the value and the gradient at the same point through
+// separate calls, both are answered from a single pass
+class GradientCache
+{
+public:
+  GradientCache(const Alignment* session) : session_(session) {}
+
+  double value(const Alignment::Params& X) const
+  {
+    update(X);
+    return value_;
+  }
+
+  const Alignment::Params& gradient(const Alignment::Params& X) const
+  {
+    update(X);
+    return grad_;
+  }
+
+private:
+  void update(const Alignment::Params& X) const
+  {
+    if (X_.size() != X.size() || X_ != X)
+    {
+      X_ = X;
+      value_ = session_->objective(X, grad_);
+    }
+  }
+
+  const Alignment* session_;
+  mutable Alignment::Params X_;
+  mutable Alignment::Params grad_;
+  mutable double value_;
+};
+
+struct CachedValue
+{
+  CachedValue(const GradientCache* c) : cache(c) {}
+  double operator()(const Alignment::Params& X) const { return cache->value(X); }
+  const GradientCache* cache;
+};
+
+struct CachedGradient
+{
+  CachedGradient(const GradientCache* c) : cache(c) {}
+  Alignment::Params operator()(const Alignment::Params& X) const
+  {
+    return cache->gradient(X);
+  }
+  const GradientCache* cache;
+};
+}  // namespace
+
+double Alignment::lbfgs(Params& X, double rho_end, int steps) const
+{
+  GradientCache cache(this);
+
+  dlib::find_min(dlib::lbfgs_search_strategy(10),
+                 dlib::objective_delta_stop_strategy(rho_end * rho_end, steps),
+                 CachedValue(&cache),
+                 CachedGradient(&cache),
+                 X,
+                 0);  // the objective is a sum of squares
+
+  return objective(X);
+}
+
+double Alignment::bobyqa(Params& X, double rho_begin, double rho_end, int steps) const
+{
+  boost::function<double (const Params&)> f =
+      boost::bind(&Alignment::objective, this, _1);
+
+  try
+  {
+    dlib::find_optimal_parameters(
+          rho_begin,
+          rho_end,
+          steps,  // max number of objective function evaluations
+          X,
+          dlib::uniform_matrix<double>(6, 1, -1e10),  // lower bound constraint
+          dlib::uniform_matrix<double>(6, 1, 1e10),  // upper bound constraint
+          f);
+  }
+  catch(dlib::bobyqa_failure& ex)
+  {
+    fprintf(stderr, "%s\n", ex.what());
+    // find_min_bobyqa will throw is it fails to converge
+  }
+
+  return f(X);
+}
+
+double Alignment::icp(Params& X, double rho_end, int steps) const
+{
+  // each step should lower the objective but rounding can make it rise,
+  // so the best iterate seen is kept and returned whatever stops the loop
+  Params best = X;
+  double best_value = -1;
+  bool scored = false;  // X has been compared against best
+
+  for (int i = 0; i < steps; i++)
+  {
+    Matrix::Mat3 R;
+    Matrix::makeRotation(R, X(3), X(4), X(5));
+    const double d[3] = {X(0), X(1), X(2)};
+
+    Matrix::RigidFit fit;
+    const double value = pairUp(R, d, fit);
+    scored = true;
+
+    // pairs only change when the objective improves, stop once it doesn't
+    if (best_value >= 0 && value >= best_value)
+    {
+      break;
+    }
+    best = X;
+    best_value = value;
+
+    Matrix::Vec3 t;
+
+    if (!fit.solve(R, t))
+    {
+      break;
+    }
+
+    Params next(6);
+    next(0) = t(0);
+    next(1) = t(1);
+    next(2) = t(2);
+    Matrix::rotationToAngles(R, next(3), next(4), next(5));
+
+    // compare angles through the rotation they produce, not their values
+    double change = 0;
+
+    for (int k = 0; k < 3; k++)
+    {
+      change = std::max(change, fabs(next(k) - X(k)));
+      change = std::max(change, fabs(remainder(next(k + 3) - X(k + 3), 2 * M_PI)));
+    }
+
+    X = next;
+    scored = false;
+
+    if (change <= rho_end)
+    {
+      break;
+    }
+  }
+
+  // the last step was taken but not scored yet
+  if (!scored)
+  {
+    Matrix::Mat3 R;
+    Matrix::makeRotation(R, X(3), X(4), X(5));
+    const double d[3] = {X(0), X(1), X(2)};
+
+    Matrix::RigidFit fit;
+
+    if (best_value < 0 || pairUp(R, d, fit) < best_value)
+    {
+      best = X;
+    }
+  }
+
+  X = best;
+  return objective(X);
+}
+
+double Alignment::minimize(Params& X, AtomContainer::AlignMethod method,
+                           double rho_begin, double rho_end, int steps) const
+{
+  if (method == AtomContainer::ICP)
+  {
+    return icp(X, rho_end, steps);
+  }
+
+  if (method == AtomContainer::LBFGS)
+  {
+    return lbfgs(X, rho_end, steps);
+  }
+
+  return bobyqa(X, rho_begin, rho_end, steps);
+}
+
+static bool resultLess(const Alignment::Result& a, const Alignment::Result& b)
+{
+  return a.diff < b.diff;
+}
+
+void Alignment::multiStart(const Params& X0, size_t starts,
+                           AtomContainer::AlignMethod method,
+                           double rho_begin, double rho_end, int steps,
+                           std::vector<Result>& results) const
+{
+  const Matrix::Vec3 ca = a_->centroid();
+  const Matrix::Vec3 cb = b_->centroid();
+
+  std::vector<Matrix::Mat3> rotations;
+  Matrix::sampleRotations(starts > 1 ? starts - 1 : 0, rotations);
+
+  std::vector<Params> X(1, X0);
+
+  for (size_t i = 0; i < rotations.size(); i++)
+  {
+    const Matrix::Vec3 d = cb - rotations[i] * ca;
+
+    Params Xi(6);
+    Xi(0) = d(0);
+    Xi(1) = d(1);
+    Xi(2) = d(2);
+    Matrix::rotationToAngles(rotations[i], Xi(3), Xi(4), Xi(5));
+    X.push_back(Xi);
+  }
+
+  std::vector<Result> all(X.size());
+
+  ThreadPool::shared().parallelFor(
+        X.size(),
+        boost::bind(&Alignment::runStart, this, _1, &X,
+                    method, rho_begin, rho_end, steps, &all));
+
+  // stable sort keeps ties in start order so results don't depend on timing
+  std::stable_sort(all.begin(), all.end(), resultLess);
+
+  // several starts usually land in the same minimum, keep the best of each
+  results.clear();
+
+  for (size_t i = 0; i < all.size(); i++)
+  {
+    Matrix::Mat3 Ri;
+    Matrix::makeRotation(Ri, all[i].X(3), all[i].X(4), all[i].X(5));
+
+    bool duplicate = false;
+
+    for (size_t j = 0; j < results.size() && !duplicate; j++)
+    {
+      Matrix::Mat3 Rj;
+      Matrix::makeRotation(Rj, results[j].X(3), results[j].X(4), results[j].X(5));
+
+      const double dr = dlib::max(dlib::abs(Ri - Rj));
+      const double dt = std::max(fabs(all[i].X(0) - results[j].X(0)),
+                                 std::max(fabs(all[i].X(1) - results[j].X(1)),
+                                          fabs(all[i].X(2) - results[j].X(2))));
+
+      duplicate = dr < 1e-3 && dt < 1e-3;
+    }
+
+    if (!duplicate)
+    {
+      results.push_back(all[i]);
+    }
+  }
+}
+
+namespace
+{
+struct PairJob
+{
+  size_t i;
+  size_t j;
+  size_t cost;
+};
+
+bool costlier(const PairJob& a, const PairJob& b)
+{
+  return a.cost > b.cost;
+}
+
+struct PairwiseTask
+{
+  void operator()(size_t k) const
+  {
+    const PairJob& job = (*jobs)[k];
+
+    Alignment session((*list)[job.i], (*list)[job.j]);
+    session.useDistanceField(field, field_margin);
+
+    double diff;
+
+    if (starts > 1)
+    {
+      std::vector<Alignment::Result> results;
+      session.multiStart(*X0, starts, method, rho_begin, rho_end, steps, results);
+      diff = results[0].diff;
+    }
+    else
+    {
+      Alignment::Params X = *X0;
+      diff = session.minimize(X, method, rho_begin, rho_end, steps);
+    }
+
+    // each task owns its two cells
+    (*residuals)(job.i, job.j) = diff;
+    (*residuals)(job.j, job.i) = diff;
+  }
+
+  const std::vector<AtomContainer::Ptr>* list;
+  const std::vector<PairJob>* jobs;
+  const Alignment::Params* X0;
+  size_t starts;
+  AtomContainer::AlignMethod method;
+  double rho_begin;
+  double rho_end;
+  int steps;
+  double field;
+  double field_margin;
+  Matrix::Type* residuals;
+};
+}  // namespace
+
+void Alignment::pairwise(const std::vector<AtomContainer::Ptr>& list,
+                         const Params& X0, size_t starts,
+                         AtomContainer::AlignMethod method,
+                         double rho_begin, double rho_end, int steps,
+                         double field, double field_margin,
+                         Matrix::Type& residuals)
+{
+  const size_t n = list.size();
+  residuals = dlib::zeros_matrix<double>(n, n);
+
+  std::vector<PairJob> jobs;
+  jobs.reserve(n * (n - 1) / 2);
+
+  for (size_t i = 0; i < n; i++)
+  {
+    for (size_t j = i + 1; j < n; j++)
+    {
+      PairJob job;
+      job.i = i;
+      job.j = j;
+      job.cost = list[i]->size() + list[j]->size();
+      jobs.push_back(job);
+    }
+  }
+
+  // build the shared indices up front rather than racing to build them in
+  // every task that touches a container
+  for (size_t i = 0; i < n; i++)
+  {
+    list[i]->kdTree();
+
+    if (field > 0)
+    {
+      list[i]->distanceField(field, field_margin);
+    }
+  }
+
+  // indices are handed out in order, starting the largest pairs first keeps
+  // a big pair from being the last one running
+  std::stable_sort(jobs.begin(), jobs.end(), costlier);
+
+  PairwiseTask task;
+  task.list = &list;
+  task.jobs = &jobs;
+  task.X0 = &X0;
+  task.starts = starts;
+  task.method = method;
+  task.rho_begin = rho_begin;
+  task.rho_end = rho_end;
+  task.steps = steps;
+  task.field = field;
+  task.field_margin = field_margin;
+  task.residuals = &residuals;
+
+  ThreadPool::shared().parallelFor(jobs.size(), task);
+}
+
+void Alignment::runStart(size_t i, const std::vector<Params>* starts,
+                         AtomContainer::AlignMethod method,
+                         double rho_begin, double rho_end, int steps,
+                         std::vector<Result>* results) const
+{
+  Result& r = (*results)[i];
+  r.X = (*starts)[i];
+  r.diff = minimize(r.X, method, rho_begin, rho_end, steps);
+}
+
+double Alignment::pairUp(const Matrix::Mat3& R, const double d[3],
+                         Matrix::RigidFit& fit) const
+{
+  const std::vector<double>& ax = a_->x();
+  const std::vector<double>& ay = a_->y();
+  const std::vector<double>& az = a_->z();
+  const std::vector<double>& bx = b_->x();
+  const std::vector<double>& by = b_->y();
+  const std::vector<double>& bz = b_->z();
+
+  double sum = 0;
+  size_t j;
+  double dist2;
+  double offset[3];  // to the nearest image of j, zero unless periodic
+
+  // a -> b
+  for (size_t i = 0; i < ax.size(); i++)
+  {
+    const double px = R(0, 0) * ax[i] + R(0, 1) * ay[i] + R(0, 2) * az[i] + d[0];
+    const double py = R(1, 0) * ax[i] + R(1, 1) * ay[i] + R(1, 2) * az[i] + d[1];
+    const double pz = R(2, 0) * ax[i] + R(2, 1) * ay[i] + R(2, 2) * az[i] + d[2];
+
+    if (b_tree_->nearest(px, py, pz, j, dist2, offset))
+    {
+      fit.add(ax[i], ay[i], az[i],
+              bx[j] + offset[0], by[j] + offset[1], bz[j] + offset[2]);
+      sum += dist2;
+    }
+  }
+
+  // b -> a, searched in the frame of a
+  for (size_t i = 0; i < bx.size(); i++)
+  {
+    const double qx = bx[i] - d[0];
+    const double qy = by[i] - d[1];
+    const double qz = bz[i] - d[2];
+
+    const double px = R(0, 0) * qx + R(1, 0) * qy + R(2, 0) * qz;
+    const double py = R(0, 1) * qx + R(1, 1) * qy + R(2, 1) * qz;
+    const double pz = R(0, 2) * qx + R(1, 2) * qy + R(2, 2) * qz;
+
+    if (a_tree_->nearest(px, py, pz, j, dist2, offset))
+    {
+      fit.add(ax[j] + offset[0], ay[j] + offset[1], az[j] + offset[2],
+              bx[i], by[i], bz[i]);
+      sum += dist2;
+    }
+  }
+
+  return sum;
+}
+
+double Alignment::closestSum(const AtomContainer& src, const AtomContainer& dst,
+                             const KdTree& tree, const Matrix::Mat3& R,
+                             const double t[3], const double d[3],
+                             Matrix::Vec3& e, Matrix::Mat3& n)
+{
+  const std::vector<double>& x = src.x();
+  const std::vector<double>& y = src.y();
+  const std::vector<double>& z = src.z();
+  const std::vector<double>& dx = dst.x();
+  const std::vector<double>& dy = dst.y();
+  const std::vector<double>& dz = dst.z();
+
+  double sum = 0;
+  double es[3] = {0, 0, 0};
+  double ns[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+
+  for (size_t i = 0; i < x.size(); i++)
+  {
+    const double q[3] = {x[i] - t[0], y[i] - t[1], z[i] - t[2]};
+    const double p[3] =
+    {
+      R(0, 0) * q[0] + R(0, 1) * q[1] + R(0, 2) * q[2] + d[0],
+      R(1, 0) * q[0] + R(1, 1) * q[1] + R(1, 2) * q[2] + d[1],
+      R(2, 0) * q[0] + R(2, 1) * q[1] + R(2, 2) * q[2] + d[2]
+    };
+
+    size_t j;
+    double dist2;
+    double offset[3];
+
+    if (tree.nearest(p[0], p[1], p[2], j, dist2, offset))
+    {
+      // residual to the nearest image of j
+      const double r[3] =
+      {
+        p[0] - dx[j] - offset[0],
+        p[1] - dy[j] - offset[1],
+        p[2] - dz[j] - offset[2]
+      };
+
+      for (int u = 0; u < 3; u++)
+      {
+        es[u] += r[u];
+
+        for (int v = 0; v < 3; v++)
+        {
+          ns[u][v] += r[u] * q[v];
+        }
+      }
+
+      sum += dist2;
+    }
+  }
+
+  for (int u = 0; u < 3; u++)
+  {
+    e(u) = es[u];
+
+    for (int v = 0; v < 3; v++)
+    {
+      n(u, v) = ns[u][v];
+    }
+  }
+
+  return sum;
+}
+
+double Alignment::fieldSum(const AtomContainer& src, const DistanceField& field,
+                           const Matrix::Mat3& R,
+                           const double t[3], const double d[3])
+{
+  const std::vector<double>& x = src.x();
+  const std::vector<double>& y = src.y();
+  const std::vector<double>& z = src.z();
+
+  double sum = 0;
+
+  for (size_t i = 0; i < x.size(); i++)
+  {
+    const double px = x[i] - t[0];
+    const double py = y[i] - t[1];
+    const double pz = z[i] - t[2];
+
+    sum += field.value(R(0, 0) * px + R(0, 1) * py + R(0, 2) * pz + d[0],
+                       R(1, 0) * px + R(1, 1) * py + R(1, 2) * pz + d[1],
+                       R(2, 0) * px + R(2, 1) * py + R(2, 2) * pz + d[2]);
+  }
+
+  return sum;
+}
+
+double Alignment::closestSum(const AtomContainer& src, const KdTree& tree,
+                             const Matrix::Mat3& R,
+                             const double t[3], const double d[3])
+{
+  const std::vector<double>& x = src.x();
+  const std::vector<double>& y = src.y();
+  const std::vector<double>& z = src.z();
+
+  double sum = 0;
+
+  for (size_t i = 0; i < x.size(); i++)
+  {
+    const double px = x[i] - t[0];
+    const double py = y[i] - t[1];
+    const double pz = z[i] - t[2];
+
+    size_t j;
+    double dist2;
+
+    if (tree.nearest(R(0, 0) * px + R(0, 1) * py + R(0, 2) * pz + d[0],
+                     R(1, 0) * px + R(1, 1) * py + R(1, 2) * pz + d[1],
+                     R(2, 0) * px + R(2, 1) * py + R(2, 2) * pz + d[2],
+                     j, dist2))
+    {
+      sum += dist2;
+    }
+  }
+
+  return sum;
+}
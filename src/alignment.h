@@ -0,0 +1,218 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      alignment.h
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef ALIGNMENT_H
+#define ALIGNMENT_H
+
+#include <boost/shared_ptr.hpp>
+#include "atomcontainer.h"
+#include "distancefield.h"
+#include "kdtree.h"
+#include "matrix.h"
+
+/**
+ * State shared by every objective evaluation while aligning container a
+ * onto container b. The nearest neighbour indices of both containers are
+ * fetched once when the session is created so evaluating the objective
+ * does not allocate.
+ */
+class Alignment
+{
+public:
+  typedef boost::shared_ptr<Alignment> Ptr;
+
+  // transform parameters: dx, dy, dz, rx, ry, rz
+  typedef dlib::matrix<double, 0, 1> Params;
+
+  /**
+   * @brief Outcome of a local alignment
+   */
+  struct Result
+  {
+    Params X;
+    double diff;
+  };
+
+  Alignment(AtomContainer::Ptr a, AtomContainer::Ptr b);
+
+  /**
+   * @brief Evaluate the objective with sampled distance fields instead of
+   *        nearest neighbour searches. The fields are cached by the
+   *        containers so aligning many candidates against one reference
+   *        builds the reference field once. Objective values become
+   *        approximate (see DistanceField); ICP still pairs exact
+   *        neighbours.
+   * @param spacing Distance between samples, 0 goes back to exact searches
+   * @param margin Padding around each container's bounding box
+   */
+  void useDistanceField(double spacing, double margin);
+
+  /**
+   * @brief Like useDistanceField but only b gets a field, distances from b
+   *        to a are still found in a's k-d tree. For screening many
+   *        candidates (a) against one reference (b) without sampling a
+   *        field for every candidate.
+   * @param spacing Distance between samples, 0 goes back to exact searches
+   * @param margin Padding around b's bounding box
+   */
+  void useReferenceField(double spacing, double margin);
+
+  /**
+   * @brief Sum of squared closest distances from b to transformed a and from
+   *        transformed a to b
+   * @param X transform parameters
+   * @return objective value
+   */
+  double objective(const Params& X) const;
+
+  /**
+   * @brief Objective and its gradient in one pass over the atoms. The
+   *        gradient holds the nearest neighbour pairs fixed, which is exact
+   *        everywhere the pairing does not change. Always uses exact
+   *        nearest neighbour searches.
+   * @param[in] X transform parameters
+   * @param[out] grad gradient with respect to X
+   * @return objective value
+   */
+  double objective(const Params& X, Params& grad) const;
+
+  /**
+   * @brief Minimize the objective with derivative free BOBYQA
+   * @param[in,out] X transform parameters
+   * @param[in] rho_begin initial trust region radius
+   * @param[in] rho_end final trust region radius
+   * @param[in] steps maximum number of objective evaluations
+   * @return objective at the final parameters
+   */
+  double bobyqa(Params& X, double rho_begin, double rho_end, int steps) const;
+
+  /**
+   * @brief Minimize the objective with iterative closest point. Each
+   *        iteration pairs atoms with their nearest neighbours in both
+   *        directions and solves for the best rigid transform of those pairs
+   *        in closed form.
+   * @param[in,out] X transform parameters, the best iterate on return
+   * @param[in] rho_end stop once no parameter changes by more than this
+   * @param[in] steps maximum number of iterations
+   * @return objective at the returned parameters
+   */
+  double icp(Params& X, double rho_end, int steps) const;
+
+  /**
+   * @brief Minimize the objective with L-BFGS using the analytic gradient
+   * @param[in,out] X transform parameters
+   * @param[in] rho_end stop once an iteration improves the objective by
+   *            less than rho_end^2
+   * @param[in] steps maximum number of iterations
+   * @return objective at the final parameters
+   */
+  double lbfgs(Params& X, double rho_end, int steps) const;
+
+  /**
+   * @brief Run a local alignment with the given method
+   * @param[in,out] X transform parameters
+   * @param[in] method Minimizer
+   * @param[in] rho_begin,rho_end,steps See bobyqa and icp
+   * @return objective at the final parameters
+   */
+  double minimize(Params& X, AtomContainer::AlignMethod method,
+                  double rho_begin, double rho_end, int steps) const;
+
+  /**
+   * @brief Global search: run local alignments from many starting
+   *        orientations on the shared thread pool. The first start is X0,
+   *        the others are evenly spread rotations with the displacement
+   *        chosen to overlap the centroids of a and b.
+   * @param[in] X0 first starting point
+   * @param[in] starts number of starting points
+   * @param[in] method,rho_begin,rho_end,steps local alignment settings
+   * @param[out] results distinct results ordered best first
+   */
+  void multiStart(const Params& X0, size_t starts,
+                  AtomContainer::AlignMethod method,
+                  double rho_begin, double rho_end, int steps,
+                  std::vector<Result>& results) const;
+
+  /**
+   * @brief Align every pair of containers in a list on the shared thread
+   *        pool. Only pairs i < j are aligned, the result is mirrored.
+   * @param[in] list Containers to compare
+   * @param[in] X0 starting transform for every pair
+   * @param[in] starts starting points per pair, see multiStart
+   * @param[in] method,rho_begin,rho_end,steps local alignment settings
+   * @param[in] field,field_margin distance field settings, see
+   *            useDistanceField
+   * @param[out] residuals list.size() x list.size() objective values with a
+   *             zero diagonal
+   */
+  static void pairwise(const std::vector<AtomContainer::Ptr>& list,
+                       const Params& X0, size_t starts,
+                       AtomContainer::AlignMethod method,
+                       double rho_begin, double rho_end, int steps,
+                       double field, double field_margin,
+                       Matrix::Type& residuals);
+
+private:
+  /**
+   * @brief Run one start of multiStart
+   */
+  void runStart(size_t i, const std::vector<Params>* starts,
+                AtomContainer::AlignMethod method,
+                double rho_begin, double rho_end, int steps,
+                std::vector<Result>* results) const;
+
+  /**
+   * @brief Pair every atom with its nearest neighbour in the other
+   *        container under the transform (R, d) and accumulate the pairs
+   * @return objective for (R, d)
+   */
+  double pairUp(const Matrix::Mat3& R, const double d[3],
+                Matrix::RigidFit& fit) const;
+
+  /**
+   * @brief Sum of squared distances from the rigidly moved points of src
+   *        to the nearest points in tree. Points are moved with
+   *        p' = R * (p - t) + d
+   */
+  static double closestSum(const AtomContainer& src, const KdTree& tree,
+                           const Matrix::Mat3& R,
+                           const double t[3], const double d[3]);
+
+  /**
+   * @brief closestSum that also accumulates, over the pairs, the residual
+   *        e = p' - q (q the nearest point of dst, which tree indexes) and
+   *        its outer product with the shifted source point e * (p - t)^T,
+   *        which is what the gradient needs
+   */
+  static double closestSum(const AtomContainer& src, const AtomContainer& dst,
+                           const KdTree& tree, const Matrix::Mat3& R,
+                           const double t[3], const double d[3],
+                           Matrix::Vec3& e, Matrix::Mat3& n);
+
+  /**
+   * @brief closestSum looked up in a distance field
+   */
+  static double fieldSum(const AtomContainer& src, const DistanceField& field,
+                         const Matrix::Mat3& R,
+                         const double t[3], const double d[3]);
+
+  AtomContainer::Ptr a_;
+  AtomContainer::Ptr b_;
+  KdTree::Ptr a_tree_;
+  KdTree::Ptr b_tree_;
+  DistanceField::Ptr a_field_;
+  DistanceField::Ptr b_field_;
+};
+
+#endif // ALIGNMENT_H
@@ -1,19 +1,325 @@
 #include "atomcontainer.h"
+#include "alignment.h"
 #include "matrix.h"
-#include <dlib/optimization/find_optimal_parameters.h>
+#include "threadpool.h"
 #include <math.h>
 #include <algorithm>
-#include <boost/function.hpp>
-#include <boost/bind.hpp>
+#include <fnmatch.h>
+#include <unordered_map>
 
 AtomContainer::AtomContainer()
+  : periodic_(false)
 {
+  lattice_ = dlib::zeros_matrix<double, 3, 3>();
 }
 
 AtomContainer::~AtomContainer()
 {
 }
 
+size_t AtomContainer::size() const
+{
+  return x_.size();
+}
+
+bool AtomContainer::empty() const
+{
+  return x_.empty();
+}
+
+void AtomContainer::clear()
+{
+  invalidate();
+  x_.clear();
+  y_.clear();
+  z_.clear();
+  type_.clear();
+  name_.clear();
+}
+
+void AtomContainer::reserve(size_t n)
+{
+  x_.reserve(n);
+  y_.reserve(n);
+  z_.reserve(n);
+  type_.reserve(n);
+  name_.reserve(n);
+}
+
+void AtomContainer::add(const Atom& a)
+{
+  double p[3] = {0, 0, 0};
+
+  if (a.pos_)
+  {
+    for (long i = 0; i < 3 && i < a.pos_->size(); i++)
+    {
+      p[i] = (*a.pos_)(i);
+    }
+  }
+
+  add(a.type_, a.name_, p[0], p[1], p[2]);
+}
+
+void AtomContainer::add(const std::string& type, const std::string& name,
+                        double x, double y, double z)
+{
+  invalidate();
+  x_.push_back(x);
+  y_.push_back(y);
+  z_.push_back(z);
+  type_.push_back(type);
+  name_.push_back(name);
+}
+
+Atom::Ptr AtomContainer::at(size_t i) const
+{
+  Atom::Ptr a(new Atom());
+
+  (*a->pos_)(0, 0) = x_[i];
+  (*a->pos_)(1, 0) = y_[i];
+  (*a->pos_)(2, 0) = z_[i];
+
+  a->type_ = type_[i];
+  a->name_ = name_[i];
+  return a;
+}
+
+void AtomContainer::setPosition(size_t i, double x, double y, double z)
+{
+  invalidate();
+  x_[i] = x;
+  y_[i] = y;
+  z_[i] = z;
+}
+
+Matrix::Vec3 AtomContainer::centroid() const
+{
+  Matrix::Vec3 c;
+  c = 0;
+
+  for (size_t i = 0; i < size(); i++)
+  {
+    c(0) += x_[i];
+    c(1) += y_[i];
+    c(2) += z_[i];
+  }
+
+  if (size())
+  {
+    c /= size();
+  }
+
+  return c;
+}
+
+Matrix::Ptr AtomContainer::coordinates() const
+{
+  Matrix::Ptr m(new Matrix::Type(size(), 3));
+
+  for (size_t i = 0; i < size(); i++)
+  {
+    (*m)(i, 0) = x_[i];
+    (*m)(i, 1) = y_[i];
+    (*m)(i, 2) = z_[i];
+  }
+
+  return m;
+}
+
+bool AtomContainer::setCoordinates(const Matrix::Type& m)
+{
+  if ((size_t)m.nr() != size() || m.nc() != 3)
+  {
+    return false;
+  }
+
+  invalidate();
+
+  for (size_t i = 0; i < size(); i++)
+  {
+    x_[i] = m(i, 0);
+    y_[i] = m(i, 1);
+    z_[i] = m(i, 2);
+  }
+
+  return true;
+}
+
+void AtomContainer::copyRows(const std::vector<size_t>& rows,
+                             AtomContainer& dest) const
+{
+  dest.invalidate();
+  dest.reserve(dest.size() + rows.size());
+
+  for (size_t k = 0; k < rows.size(); k++)
+  {
+    const size_t i = rows[k];
+    dest.x_.push_back(x_[i]);
+    dest.y_.push_back(y_[i]);
+    dest.z_.push_back(z_[i]);
+    dest.type_.push_back(type_[i]);
+    dest.name_.push_back(name_[i]);
+  }
+}
+
+AtomContainer::Ptr AtomContainer::subset(const std::vector<size_t>& rows) const
+{
+  AtomContainer::Ptr ac(new AtomContainer());
+  copyRows(rows, *ac);
+  ac->periodic_ = periodic_;
+  ac->lattice_ = lattice_;
+  return ac;
+}
+
+void AtomContainer::selectTypes(const std::vector<std::string>& types,
+                                std::vector<size_t>& rows) const
+{
+  rows.clear();
+
+  for (size_t i = 0; i < size(); i++)
+  {
+    if (std::find(types.begin(), types.end(), type_[i]) != types.end())
+    {
+      rows.push_back(i);
+    }
+  }
+}
+
+void AtomContainer::selectName(const std::string& pattern,
+                               std::vector<size_t>& rows) const
+{
+  rows.clear();
+
+  for (size_t i = 0; i < size(); i++)
+  {
+    if (fnmatch(pattern.c_str(), name_[i].c_str(), 0) == 0)
+    {
+      rows.push_back(i);
+    }
+  }
+}
+
+void AtomContainer::keep(const std::vector<size_t>& rows)
+{
+  invalidate();
+
+  AtomContainer kept;
+  copyRows(rows, kept);
+
+  x_.swap(kept.x_);
+  y_.swap(kept.y_);
+  z_.swap(kept.z_);
+  type_.swap(kept.type_);
+  name_.swap(kept.name_);
+}
+
+// true if the rows of the lattice span a volume
+static bool spansVolume(const Matrix::Mat3& lattice)
+{
+  // compare the volume to the vector lengths so the test is scale free
+  const double volume = fabs(dlib::det(lattice));
+  const double scale = dlib::length(dlib::rowm(lattice, 0)) *
+                       dlib::length(dlib::rowm(lattice, 1)) *
+                       dlib::length(dlib::rowm(lattice, 2));
+
+  return volume > 1e-10 * scale;
+}
+
+bool AtomContainer::setLattice(const Matrix::Mat3& lattice)
+{
+  if (!spansVolume(lattice))
+  {
+    return false;
+  }
+
+  invalidate();
+  periodic_ = true;
+  lattice_ = lattice;
+  return true;
+}
+
+void AtomContainer::clearLattice()
+{
+  invalidate();
+  periodic_ = false;
+  lattice_ = dlib::zeros_matrix<double, 3, 3>();
+}
+
+bool AtomContainer::periodic() const
+{
+  return periodic_;
+}
+
+const Matrix::Mat3& AtomContainer::lattice() const
+{
+  return lattice_;
+}
+
+KdTree::Ptr AtomContainer::kdTree() const
+{
+  // concurrent first calls may each build a tree, only one is kept
+  KdTree::Ptr tree = boost::atomic_load(&kdtree_);
+
+  if (!tree)
+  {
+    double lattice[3][3];
+
+    for (int k = 0; k < 3; k++)
+    {
+      for (int a = 0; a < 3; a++)
+      {
+        lattice[k][a] = lattice_(k, a);
+      }
+    }
+
+    tree = KdTree::Ptr(new KdTree());
+    tree->build(x_.data(), y_.data(), z_.data(), x_.size(),
+                periodic_ ? lattice : 0);
+    boost::atomic_store(&kdtree_, tree);
+  }
+
+  return tree;
+}
+
+CellList::Ptr AtomContainer::cellList(double cell_size) const
+{
+  CellList::Ptr grid = boost::atomic_load(&grid_);
+
+  if (!grid || grid->requestedCellSize() != cell_size)
+  {
+    grid = CellList::Ptr(new CellList());
+    grid->build(x_.data(), y_.data(), z_.data(), x_.size(), cell_size);
+    boost::atomic_store(&grid_, grid);
+  }
+
+  return grid;
+}
+
+DistanceField::Ptr AtomContainer::distanceField(double spacing, double margin,
+                                               size_t max_samples) const
+{
+  DistanceField::Ptr field = boost::atomic_load(&field_);
+
+  if (!field || field->requestedSpacing() != spacing ||
+      field->margin() != margin)
+  {
+    field = DistanceField::Ptr(new DistanceField());
+    field->build(*kdTree(), x_.data(), y_.data(), z_.data(), x_.size(),
+                 spacing, margin, max_samples);
+    boost::atomic_store(&field_, field);
+  }
+
+  return field;
+}
+
+void AtomContainer::invalidate()
+{
+  kdtree_.reset();
+  field_.reset();
+  grid_.reset();
+}
+
 void AtomContainer::extend(AtomContainer::Ptr ac)
 {
   if (ac)
@@ -24,154 +330,415 @@ void AtomContainer::extend(AtomContainer::Ptr ac)
 
 void AtomContainer::extend(const AtomContainer& ac)
 {
-  for (size_t i = 0; i < ac.atoms_.size(); i++)
+  // size is taken up front so a container can be extended with itself
+  const size_t n = ac.size();
+
+  for (size_t i = 0; i < n; i++)
+  {
+    add(ac.type_[i], ac.name_[i], ac.x_[i], ac.y_[i], ac.z_[i]);
+  }
+}
+
+bool AtomContainer::replicate(const Matrix::Mat3& lattice, long na, long nb, long nc)
+{
+  return replicate(lattice, na, nb, nc, (const double*)0, 0);
+}
+
+bool AtomContainer::replicate(const Matrix::Mat3& lattice, long na, long nb, long nc,
+                              const Matrix::Vec3& centre, double cutoff)
+{
+  const double c[3] = {centre(0), centre(1), centre(2)};
+  return replicate(lattice, na, nb, nc, c, cutoff);
+}
+
+bool AtomContainer::replicate(const Matrix::Mat3& lattice, long na, long nb, long nc,
+                              const double* centre, double cutoff)
+{
+  if (na < 1 || nb < 1 || nc < 1 || !spansVolume(lattice) ||
+      (centre && !(cutoff >= 0)))
+  {
+    return false;
+  }
+
+  const size_t n = x_.size();
+
+  // bounds the output and the clipping pass, divisions avoid overflow
+  const size_t limit = MAX_REPLICA_ROWS / std::max(n, (size_t)1);
+
+  if ((size_t)na > limit || (size_t)nb > limit / na ||
+      (size_t)nc > limit / (na * nb))
+  {
+    return false;
+  }
+
+  const size_t images = na * nb * nc;
+  const double cutoff2 = cutoff * cutoff;
+
+  // translation of each image
+  std::vector<double> shift[3];
+
+  for (int a = 0; a < 3; a++)
+  {
+    shift[a].reserve(images);
+  }
+
+  for (long i = 0; i < na; i++)
+  {
+    for (long j = 0; j < nb; j++)
+    {
+      for (long k = 0; k < nc; k++)
+      {
+        for (int a = 0; a < 3; a++)
+        {
+          shift[a].push_back(i * lattice(0, a) + j * lattice(1, a) + k * lattice(2, a));
+        }
+      }
+    }
+  }
+
+  // clipping needs a counting pass so the columns are still sized once
+  size_t total = n * images;
+
+  if (centre)
+  {
+    total = 0;
+
+    for (size_t m = 0; m < images; m++)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        const double ex = x_[i] + shift[0][m] - centre[0];
+        const double ey = y_[i] + shift[1][m] - centre[1];
+        const double ez = z_[i] + shift[2][m] - centre[2];
+
+        total += ex * ex + ey * ey + ez * ez <= cutoff2;
+      }
+    }
+  }
+
+  AtomContainer cells;
+  cells.reserve(total);
+
+  for (size_t m = 0; m < images; m++)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      const double px = x_[i] + shift[0][m];
+      const double py = y_[i] + shift[1][m];
+      const double pz = z_[i] + shift[2][m];
+
+      if (centre)
+      {
+        const double ex = px - centre[0];
+        const double ey = py - centre[1];
+        const double ez = pz - centre[2];
+
+        if (ex * ex + ey * ey + ez * ez > cutoff2)
+        {
+          continue;
+        }
+      }
+
+      cells.x_.push_back(px);
+      cells.y_.push_back(py);
+      cells.z_.push_back(pz);
+      cells.type_.push_back(type_[i]);
+      cells.name_.push_back(name_[i]);
+    }
+  }
+
+  invalidate();
+
+  x_.swap(cells.x_);
+  y_.swap(cells.y_);
+  z_.swap(cells.z_);
+  type_.swap(cells.type_);
+  name_.swap(cells.name_);
+
+  if (centre)
   {
-    atoms_.push_back(Atom::Ptr(new Atom(*ac.atoms_[i])));
+    clearLattice();
+    return true;
   }
+
+  Matrix::Mat3 super = lattice;
+  const long counts[3] = {na, nb, nc};
+
+  for (int k = 0; k < 3; k++)
+  {
+    for (int a = 0; a < 3; a++)
+    {
+      super(k, a) *= counts[k];
+    }
+  }
+
+  setLattice(super);
+  return true;
 }
 
 void AtomContainer::transform(double dx, double dy, double dz,
                               double rx, double ry, double rz)
 {
-  Matrix::Type Rot, RX, RY, RZ;
-  Matrix::makeRotationX(RX, rx);
-  Matrix::makeRotationY(RY, ry);
-  Matrix::makeRotationZ(RZ, rz);
+  invalidate();
 
-  Rot = (RX * RY) * RZ;
+  Matrix::Mat3 Rot;
+  Matrix::makeRotation(Rot, rx, ry, rz);
 
-  Matrix::Type d(3, 1);
-  d(0, 0) = dx;
-  d(1, 0) = dy;
-  d(2, 0) = dz;
+  // lattice vectors are rows, a' = Rot a
+  lattice_ = lattice_ * dlib::trans(Rot);
 
-  for (size_t i = 0; i < atoms_.size(); i++)
+  for (size_t i = 0; i < x_.size(); i++)
   {
-    (*atoms_[i]->pos_) = Rot * (*atoms_[i]->pos_) + d;
+    const double x = x_[i];
+    const double y = y_[i];
+    const double z = z_[i];
+
+    x_[i] = Rot(0, 0) * x + Rot(0, 1) * y + Rot(0, 2) * z + dx;
+    y_[i] = Rot(1, 0) * x + Rot(1, 1) * y + Rot(1, 2) * z + dy;
+    z_[i] = Rot(2, 0) * x + Rot(2, 1) * y + Rot(2, 2) * z + dz;
   }
 }
 
 void AtomContainer::untransform(double dx, double dy, double dz,
                                 double rx, double ry, double rz)
 {
-  Matrix::Type invRot, RX, RY, RZ;
-  Matrix::makeRotationX(RX, rx);
-  Matrix::makeRotationY(RY, ry);
-  Matrix::makeRotationZ(RZ, rz);
+  invalidate();
 
-  invRot = dlib::inv((RX * RY) * RZ);
+  Matrix::Mat3 Rot;
+  Matrix::makeRotation(Rot, rx, ry, rz);
 
-  Matrix::Type d(3, 1);
-  d(0, 0) = dx;
-  d(1, 0) = dy;
-  d(2, 0) = dz;
+  // rotations are orthonormal, the inverse is the transpose
+  const Matrix::Mat3 invRot = dlib::trans(Rot);
+  lattice_ = lattice_ * Rot;
 
-  for (size_t i = 0; i < atoms_.size(); i++)
+  for (size_t i = 0; i < x_.size(); i++)
   {
-    (*atoms_[i]->pos_) = invRot * ((*atoms_[i]->pos_) - d);
+    const double x = x_[i] - dx;
+    const double y = y_[i] - dy;
+    const double z = z_[i] - dz;
+
+    x_[i] = invRot(0, 0) * x + invRot(0, 1) * y + invRot(0, 2) * z;
+    y_[i] = invRot(1, 0) * x + invRot(1, 1) * y + invRot(1, 2) * z;
+    z_[i] = invRot(2, 0) * x + invRot(2, 1) * y + invRot(2, 2) * z;
   }
 }
 
 AtomContainer::Ptr AtomContainer::copy()
 {
-  AtomContainer::Ptr p(new AtomContainer());
-  p->extend(*this);
-  return p;
+  return AtomContainer::Ptr(new AtomContainer(*this));
 }
 
 bool AtomContainer::near(Matrix::Ptr p, size_t& idx, double& dist2) const
 {
-  if (atoms_.empty())
+  if (!p || p->size() < 3)
+  {
+    return false;
+  }
+
+  return near((*p)(0), (*p)(1), (*p)(2), idx, dist2);
+}
+
+bool AtomContainer::near(double px, double py, double pz,
+                         size_t& idx, double& dist2) const
+{
+  if (x_.empty())
   {
     return false;
   }
 
-  if (!p)
+  return kdTree()->nearest(px, py, pz, idx, dist2);
+}
+
+bool AtomContainer::anyWithin(double px, double py, double pz, double r) const
+{
+  if (x_.empty())
   {
     return false;
   }
 
-  idx = 0;
-  dist2 = Matrix::sumOfSquares(*p - *atoms_[0]->pos_);
+  return cellList(r)->anyWithin(px, py, pz, r);
+}
+
+size_t AtomContainer::withinRadius(double px, double py, double pz, double r,
+                                   std::vector<size_t>& idx) const
+{
+  idx.clear();
+
+  if (x_.empty())
+  {
+    return 0;
+  }
+
+  return cellList(r)->withinRadius(px, py, pz, r, idx);
+}
+
+// atoms per parallel task. Fixed, not derived from the thread count, so
+// reductions add the same values in the same order on any machine.
+static const size_t CHUNK_SIZE = 1024;
+
+static size_t chunkCount(size_t n)
+{
+  return (n + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
 
-  for (size_t i = 1; i < atoms_.size(); i++)
+// sum by recursive halving, error grows with log(n) rather than n
+static double pairwiseSum(const double* v, size_t n)
+{
+  if (n <= 8)
   {
-    const double dist2_i = Matrix::sumOfSquares(*p - *atoms_[i]->pos_);
+    double sum = 0;
 
-    if (dist2_i < dist2)
+    for (size_t i = 0; i < n; i++)
     {
-      dist2 = dist2_i;
-      idx = i;
+      sum += v[i];
     }
+
+    return sum;
   }
 
-  return true;
+  const size_t half = n / 2;
+  return pairwiseSum(v, half) + pairwiseSum(v + half, n - half);
 }
 
-void AtomContainer::intersect(const AtomContainer& ac, double tol)
+namespace
+{
+// pairwise sum of nearest squared distances over one chunk of a
+struct ClosestTask
 {
-  size_t closest_idx;
-  double closest_dist2;
-  const double tol2 = tol * tol;
+  void operator()(size_t c) const
+  {
+    const size_t begin = c * CHUNK_SIZE;
+    const size_t end = std::min(begin + CHUNK_SIZE, a->size());
+    double dist2[CHUNK_SIZE];
+
+    for (size_t i = begin; i < end; i++)
+    {
+      size_t j;
+      tree->nearest(a->x()[i], a->y()[i], a->z()[i], j, dist2[i - begin]);
+    }
+
+    (*sums)[c] = pairwiseSum(dist2, end - begin);
+  }
 
-  std::vector<Atom::Ptr> good;
+  const AtomContainer* a;
+  const KdTree* tree;
+  std::vector<double>* sums;
+};
 
-  for (size_t i = 0; i < atoms_.size(); i++)
+// displacement from each atom of a chunk to its nearest atom in b
+struct DisplacementTask
+{
+  void operator()(size_t c) const
   {
-    if (ac.near(atoms_[i]->pos_, closest_idx, closest_dist2))
+    const size_t begin = c * CHUNK_SIZE;
+    const size_t end = std::min(begin + CHUNK_SIZE, a->size());
+
+    for (size_t i = begin; i < end; i++)
     {
-      if (closest_dist2 <= tol2)
-      {
-        good.push_back(atoms_[i]);
-      }
+      size_t j;
+      double dist2;
+      double offset[3];
+      tree->nearest(a->x()[i], a->y()[i], a->z()[i], j, dist2, offset);
+
+      // towards the nearest image of j
+      Matrix::Ptr displacement = Matrix::Ptr(new Matrix::Type(3, 1));
+
+      (*displacement)(0, 0) = b->x()[j] + offset[0] - a->x()[i];
+      (*displacement)(1, 0) = b->y()[j] + offset[1] - a->y()[i];
+      (*displacement)(2, 0) = b->z()[j] + offset[2] - a->z()[i];
+
+      v[i] = displacement;
     }
   }
 
-  // replace vector with atoms that are within tol of atoms in other container
-  atoms_ = good;
-}
+  const AtomContainer* a;
+  const AtomContainer* b;
+  const KdTree* tree;
+  Matrix::Ptr* v;  // a->size() entries
+};
 
-double AtomContainer::closestDistanceSquared(const AtomContainer& a, const AtomContainer& b)
+// flags atoms of a chunk that have a grid point within tol
+struct IntersectTask
 {
-  double sum = 0;
+  void operator()(size_t c) const
+  {
+    const size_t begin = c * CHUNK_SIZE;
+    const size_t end = std::min(begin + CHUNK_SIZE, a->size());
+
+    for (size_t i = begin; i < end; i++)
+    {
+      (*near)[i] = grid->anyWithin(a->x()[i], a->y()[i], a->z()[i], tol);
+    }
+  }
+
+  const AtomContainer* a;
+  const CellList* grid;
+  double tol;
+  std::vector<char>* near;
+};
+}  // namespace
 
-  for (size_t i = 0; i < a.atoms_.size(); i++)
+void AtomContainer::intersect(const AtomContainer& ac, double tol)
+{
+  tol = fabs(tol);
+
+  std::vector<size_t> good;
+
+  if (!ac.empty())
   {
-    size_t j;
-    double dist_ij;
+    // cells of edge tol, each query touches about 3x3x3 of them and
+    // returns at the first atom in range
+    CellList::Ptr grid = ac.cellList(tol);
+    std::vector<char> near(x_.size());
+
+    IntersectTask task;
+    task.a = this;
+    task.grid = grid.get();
+    task.tol = tol;
+    task.near = &near;
 
-    if (b.near(a.atoms_[i]->pos_, j, dist_ij))
+    ThreadPool::shared().parallelFor(chunkCount(x_.size()), task);
+
+    for (size_t i = 0; i < x_.size(); i++)
     {
-      sum += dist_ij;
+      if (near[i])
+      {
+        good.push_back(i);
+      }
     }
   }
 
-  return sum;
+  // keep only atoms that are within tol of atoms in other container
+  keep(good);
 }
 
-typedef dlib::matrix<double,0,1> column_vector;
-
-static double objective_function(AtomContainer::Ptr a,
-                                 AtomContainer::Ptr b,
-                                 const column_vector& X)
+double AtomContainer::closestDistanceSquared(const AtomContainer& a, const AtomContainer& b)
 {
-  AtomContainer::Ptr c = a->copy();
+  if (a.empty() || b.empty())
+  {
+    return 0;
+  }
+
+  KdTree::Ptr tree = b.kdTree();
+  std::vector<double> sums(chunkCount(a.size()));
 
-  c->transform(X(0), X(1), X(2), X(3), X(4), X(5));
+  ClosestTask task;
+  task.a = &a;
+  task.tree = tree.get();
+  task.sums = &sums;
 
-  // checking both ways:
-  const double bc = AtomContainer::closestDistanceSquared(*b, *c);
-  const double cb = AtomContainer::closestDistanceSquared(*c, *b);
+  ThreadPool::shared().parallelFor(sums.size(), task);
 
-  return bc + cb;
+  return pairwiseSum(sums.data(), sums.size());
 }
 
 double AtomContainer::align(AtomContainer::Ptr a, AtomContainer::Ptr b,
                             double& dx, double& dy, double& dz,
                             double& rx, double& ry, double& rz,
-                            double rho_begin, double rho_end, int steps)
+                            double rho_begin, double rho_end, int steps,
+                            AlignMethod method)
 {
-  column_vector X(6);
+  Alignment::Params X(6);
   X(0) = dx;
   X(1) = dy;
   X(2) = dz;
@@ -179,24 +746,8 @@ double AtomContainer::align(AtomContainer::Ptr a, AtomContainer::Ptr b,
   X(4) = ry;
   X(5) = rz;
 
-  boost::function<double (const column_vector&)> f = boost::bind(objective_function, a, b, _1);
-
-  try
-  {
-    dlib::find_optimal_parameters(
-          rho_begin,
-          rho_end,
-          steps,  // max number of objective function evaluations
-          X,
-          dlib::uniform_matrix<double>(6, 1, -1e10),  // lower bound constraint
-          dlib::uniform_matrix<double>(6, 1, 1e10),  // upper bound constraint
-          f);
-  }
-  catch(dlib::bobyqa_failure ex)
-  {
-    fprintf(stderr, "%s\n", ex.what());
-    // find_min_bobyqa will throw is it fails to converge
-  }
+  Alignment session(a, b);
+  const double diff = session.minimize(X, method, rho_begin, rho_end, steps);
 
   dx = X(0);
   dy = X(1);
@@ -204,25 +755,144 @@ double AtomContainer::align(AtomContainer::Ptr a, AtomContainer::Ptr b,
   rx = X(3);
   ry = X(4);
   rz = X(5);
-  return f(X);
+  return diff;
 }
 
-void AtomContainer::displacements(const AtomContainer& a,
-                                  const AtomContainer& b,
-                                  std::vector<Matrix::Ptr>& v)
+typedef std::unordered_map<std::string, size_t> NameIndex;
+
+static const size_t AMBIGUOUS = (size_t)-1;
+
+// map each name to its row, or to AMBIGUOUS if it appears more than once
+static void indexNames(const std::vector<std::string>& names, NameIndex& index)
 {
-  size_t j;
-  double dist2;
+  index.reserve(names.size());
 
-  for (size_t i = 0; i < a.atoms_.size(); i++)
+  for (size_t i = 0; i < names.size(); i++)
   {
-    if (b.near(a.atoms_[i]->pos_, j, dist2))
+    std::pair<NameIndex::iterator, bool> it =
+        index.insert(std::make_pair(names[i], i));
+
+    if (!it.second)
     {
-      Matrix::Ptr displacement = Matrix::Ptr(new Matrix::Type(1, 1));
+      it.first->second = AMBIGUOUS;
+    }
+  }
+}
+
+bool AtomContainer::fitRows(const AtomContainer& a, const AtomContainer& b,
+                            const std::vector<size_t>& ra,
+                            const std::vector<size_t>& rb,
+                            double& dx, double& dy, double& dz,
+                            double& rx, double& ry, double& rz,
+                            double& rmsd)
+{
+  Matrix::RigidFit fit;
 
-      (*displacement) = (*(b.atoms_[j]->pos_)) - (*(a.atoms_[i]->pos_));
+  for (size_t k = 0; k < ra.size(); k++)
+  {
+    const size_t i = ra[k];
+    const size_t j = rb[k];
+    fit.add(a.x_[i], a.y_[i], a.z_[i], b.x_[j], b.y_[j], b.z_[j]);
+  }
+
+  Matrix::Mat3 R;
+  Matrix::Vec3 d;
 
-      v.push_back(displacement);
+  if (!fit.solve(R, d))
+  {
+    return false;
+  }
+
+  double sum = 0;
+
+  for (size_t k = 0; k < ra.size(); k++)
+  {
+    const size_t i = ra[k];
+    const size_t j = rb[k];
+
+    const double ex = R(0, 0) * a.x_[i] + R(0, 1) * a.y_[i] + R(0, 2) * a.z_[i] + d(0) - b.x_[j];
+    const double ey = R(1, 0) * a.x_[i] + R(1, 1) * a.y_[i] + R(1, 2) * a.z_[i] + d(1) - b.y_[j];
+    const double ez = R(2, 0) * a.x_[i] + R(2, 1) * a.y_[i] + R(2, 2) * a.z_[i] + d(2) - b.z_[j];
+    sum += ex * ex + ey * ey + ez * ez;
+  }
+
+  dx = d(0);
+  dy = d(1);
+  dz = d(2);
+  Matrix::rotationToAngles(R, rx, ry, rz);
+  rmsd = sqrt(sum / ra.size());
+  return true;
+}
+
+bool AtomContainer::alignByIndex(const AtomContainer& a, const AtomContainer& b,
+                                 double& dx, double& dy, double& dz,
+                                 double& rx, double& ry, double& rz,
+                                 double& rmsd)
+{
+  if (a.size() != b.size())
+  {
+    return false;
+  }
+
+  std::vector<size_t> rows(a.size());
+
+  for (size_t i = 0; i < rows.size(); i++)
+  {
+    rows[i] = i;
+  }
+
+  return fitRows(a, b, rows, rows, dx, dy, dz, rx, ry, rz, rmsd);
+}
+
+bool AtomContainer::alignByName(const AtomContainer& a, const AtomContainer& b,
+                                double& dx, double& dy, double& dz,
+                                double& rx, double& ry, double& rz,
+                                double& rmsd, size_t& pairs)
+{
+  // row of each name, names seen more than once are ambiguous
+  NameIndex in_a;
+  NameIndex in_b;
+  indexNames(a.name_, in_a);
+  indexNames(b.name_, in_b);
+
+  std::vector<size_t> ra;
+  std::vector<size_t> rb;
+
+  for (size_t i = 0; i < a.size(); i++)
+  {
+    NameIndex::const_iterator it = in_b.find(a.name_[i]);
+
+    if (it != in_b.end() && it->second != AMBIGUOUS &&
+        in_a.find(a.name_[i])->second != AMBIGUOUS)
+    {
+      ra.push_back(i);
+      rb.push_back(it->second);
     }
   }
+
+  pairs = ra.size();
+  return fitRows(a, b, ra, rb, dx, dy, dz, rx, ry, rz, rmsd);
+}
+
+void AtomContainer::displacements(const AtomContainer& a,
+                                  const AtomContainer& b,
+                                  std::vector<Matrix::Ptr>& v)
+{
+  if (a.empty() || b.empty())
+  {
+    return;
+  }
+
+  KdTree::Ptr tree = b.kdTree();
+
+  const size_t first = v.size();
+  v.resize(first + a.size());
+
+  DisplacementTask task;
+  task.a = &a;
+  task.b = &b;
+  task.tree = tree.get();
+  task.v = &v[first];
+
+  ThreadPool::shared().parallelFor(chunkCount(a.size()), task);
 }
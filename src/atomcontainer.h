@@ -3,20 +3,207 @@
 
 #include <boost/shared_ptr.hpp>
 #include "atom.h"
+#include "celllist.h"
+#include "distancefield.h"
+#include "kdtree.h"
 #include "matrix.h"
 #include <string>
 #include <vector>
 
 
+/**
+ * Atoms are stored as a structure of arrays: one contiguous column per
+ * coordinate axis plus type and name columns. Atom objects are only built
+ * when a single row is requested (for example, to hand to Lua) and are
+ * copies of that row.
+ *
+ * A k-d tree over the coordinates is built on first use and kept until the
+ * container is modified.
+ *
+ * A container may carry lattice vectors. It then stands for one unit cell
+ * of a crystal and nearest neighbour searches against it (near,
+ * closestDistanceSquared, displacements, alignment) use minimum image
+ * distances, see KdTree.
+ */
 class AtomContainer
 {
 public:
   typedef boost::shared_ptr<AtomContainer> Ptr;
 
+  /**
+   * @brief Minimizers available to align
+   */
+  enum AlignMethod
+  {
+    BOBYQA,  // derivative free search over the transform parameters
+    ICP,  // iterative closest point with closed form rigid fits
+    LBFGS  // quasi-Newton search using the analytic gradient
+  };
+
+  /**
+   * @brief Upper bound on atoms times cells for replicate, before clipping
+   */
+  static const size_t MAX_REPLICA_ROWS = (size_t)1 << 28;
+
   AtomContainer();
   ~AtomContainer();
 
-  std::vector<Atom::Ptr> atoms_;
+  /**
+   * @brief Number of atoms in the container
+   */
+  size_t size() const;
+
+  /**
+   * @brief True if the container has no atoms
+   */
+  bool empty() const;
+
+  /**
+   * @brief Remove all atoms
+   */
+  void clear();
+
+  /**
+   * @brief Reserve space in every column for n atoms
+   * @param n Number of atoms
+   */
+  void reserve(size_t n);
+
+  /**
+   * @brief Append a copy of an atom to the container
+   * @param a Atom to copy
+   */
+  void add(const Atom& a);
+
+  /**
+   * @brief Append an atom to the container
+   * @param type Atom type
+   * @param name Atom name
+   * @param x,y,z Atom position
+   */
+  void add(const std::string& type, const std::string& name,
+           double x, double y, double z);
+
+  /**
+   * @brief Build an atom from a row of the container
+   * @param i Row index, expected to be valid
+   * @return new atom holding a copy of the row
+   */
+  Atom::Ptr at(size_t i) const;
+
+  /**
+   * @brief Overwrite the position of an atom
+   * @param i Row index, expected to be valid
+   * @param x,y,z New position
+   */
+  void setPosition(size_t i, double x, double y, double z);
+
+  /**
+   * @brief Keep only the given rows, in the given order
+   * @param rows Row indices to keep
+   */
+  void keep(const std::vector<size_t>& rows);
+
+  /**
+   * @brief Copy the given rows into a new container
+   * @param rows Row indices to copy, in order
+   * @return new container
+   */
+  AtomContainer::Ptr subset(const std::vector<size_t>& rows) const;
+
+  /**
+   * @brief Find the rows whose type is one of the given types
+   * @param[in] types Types to match exactly
+   * @param[out] rows Matching row indices, ascending
+   */
+  void selectTypes(const std::vector<std::string>& types,
+                   std::vector<size_t>& rows) const;
+
+  /**
+   * @brief Find the rows whose name matches a shell style wildcard pattern
+   * @param[in] pattern Pattern as understood by fnmatch, e.g. "C*" or "H?"
+   * @param[out] rows Matching row indices, ascending
+   */
+  void selectName(const std::string& pattern, std::vector<size_t>& rows) const;
+
+  /**
+   * @brief Copy all positions into a matrix
+   * @return size() x 3 matrix, one row per atom
+   */
+  Matrix::Ptr coordinates() const;
+
+  /**
+   * @brief Overwrite all positions from a matrix
+   * @param m size() x 3 matrix, one row per atom
+   * @return false if the matrix has the wrong shape, container is unchanged
+   */
+  bool setCoordinates(const Matrix::Type& m);
+
+  /**
+   * @brief Mean position of the atoms, zero for an empty container
+   */
+  Matrix::Vec3 centroid() const;
+
+  /**
+   * @brief Coordinate and property columns
+   */
+  const std::vector<double>& x() const { return x_; }
+  const std::vector<double>& y() const { return y_; }
+  const std::vector<double>& z() const { return z_; }
+  const std::vector<std::string>& types() const { return type_; }
+  const std::vector<std::string>& names() const { return name_; }
+
+  /**
+   * @brief Make the container periodic
+   * @param lattice Lattice vectors a, b and c as rows
+   * @return false if the vectors do not span a volume, container is unchanged
+   */
+  bool setLattice(const Matrix::Mat3& lattice);
+
+  /**
+   * @brief Drop the lattice, searches go back to open space
+   */
+  void clearLattice();
+
+  /**
+   * @brief True if the container has lattice vectors
+   */
+  bool periodic() const;
+
+  /**
+   * @brief Lattice vectors as rows, only meaningful if periodic()
+   */
+  const Matrix::Mat3& lattice() const;
+
+  /**
+   * @brief Get the nearest neighbour index over the container coordinates,
+   *        building it if needed. Safe to call from several threads as long
+   *        as the container is not being modified.
+   * @return k-d tree, indices refer to rows of this container
+   */
+  KdTree::Ptr kdTree() const;
+
+  /**
+   * @brief Get a uniform grid over the container coordinates, building it if
+   *        needed. The last grid built is kept until the container is
+   *        modified and reused for the same cell size.
+   * @param cell_size Edge length of a cell, see CellList::build
+   * @return cell list, indices refer to rows of this container
+   */
+  CellList::Ptr cellList(double cell_size) const;
+
+  /**
+   * @brief Get a sampled squared distance field around the container,
+   *        building it if needed. The last field built is kept until the
+   *        container is modified and reused for the same spacing and margin.
+   * @param spacing Requested distance between samples
+   * @param margin Padding around the bounding box of the atoms
+   * @param max_samples Upper bound on the number of samples, the spacing is
+   *        coarsened to respect it
+   * @return distance field
+   */
+  DistanceField::Ptr distanceField(double spacing, double margin,
+                                   size_t max_samples = 1 << 26) const;
 
   /**
    * @brief Add a copy of the provided atoms to the current container
@@ -30,6 +217,31 @@ public:
    */
   void extend(const AtomContainer& ac);
 
+  /**
+   * @brief Replace the atoms by a supercell: copies of every atom translated
+   *        by i a + j b + k c for i in [0, na), j in [0, nb), k in [0, nc).
+   *        Rows are ordered image by image, with i varying slowest. The
+   *        container becomes periodic with lattice vectors na a, nb b, nc c.
+   * @param lattice Lattice vectors a, b and c as rows
+   * @param na,nb,nc Number of cells along each lattice vector, at least 1
+   * @return false if a count is below 1, size() * na * nb * nc exceeds
+   *         MAX_REPLICA_ROWS or the lattice does not span a volume,
+   *         container is unchanged
+   */
+  bool replicate(const Matrix::Mat3& lattice, long na, long nb, long nc);
+
+  /**
+   * @brief Build a supercell as above keeping only the copies within cutoff
+   *        of a centre. The result is a finite fragment and has no lattice.
+   * @param lattice,na,nb,nc see above
+   * @param centre Centre of the cutoff sphere
+   * @param cutoff Radius of the sphere, atoms at exactly cutoff are kept
+   * @return false on bad counts or lattice as above, or a negative cutoff,
+   *         container is unchanged
+   */
+  bool replicate(const Matrix::Mat3& lattice, long na, long nb, long nc,
+                 const Matrix::Vec3& centre, double cutoff);
+
   /**
    * @brief Transform a container by applying translations and rotations
    * @param[in] dx,dy,dz Displacement values
@@ -61,6 +273,34 @@ public:
    */
   bool near(Matrix::Ptr p, size_t& idx, double& dist2) const;
 
+  /**
+   * @brief Get the index of the atom nearest to the provided point
+   * @param[in] px,py,pz Point
+   * @param[out] idx Closest index
+   * @param[out] dist2 Distance squared between given atom and nearest atom
+   * @return true if container has atoms
+   */
+  bool near(double px, double py, double pz, size_t& idx, double& dist2) const;
+
+  /**
+   * @brief Test whether any atom lies within r of a point, stopping at the
+   *        first one found. Uses cellList(r).
+   * @param px,py,pz Point
+   * @param r Radius, atoms at exactly r count
+   * @return true if an atom was found
+   */
+  bool anyWithin(double px, double py, double pz, double r) const;
+
+  /**
+   * @brief Get the indices of every atom within r of a point. Uses cellList(r).
+   * @param[in] px,py,pz Point
+   * @param[in] r Radius, atoms at exactly r count
+   * @param[out] idx Indices in increasing order, replaces the contents
+   * @return number of atoms found
+   */
+  size_t withinRadius(double px, double py, double pz, double r,
+                      std::vector<size_t>& idx) const;
+
   /**
    * @brief Intersect the calling conatainer against another. Atoms in the calling
    *        container that are greater than tol distance away from an atom in the
@@ -87,15 +327,46 @@ public:
    * @param[in,out] dx,dy,dz Displacement values
    * @param[in,out] rx,ry,rz Rotation values
    * @param[in] rho_begin initial tolerance
-   * @param[in] rho_begin final tolerance
-   * @param[in] steps Number of steps
+   * @param[in] rho_end final tolerance
+   * @param[in] steps Number of steps (evaluations for BOBYQA, iterations for ICP)
+   * @param[in] method Minimizer to use
    * @return distance squared between final positions
    */
   static double align(AtomContainer::Ptr a, AtomContainer::Ptr b,
                       double& dx, double& dy, double& dz,
                       double& rx, double& ry, double& rz,
                       double rho_begin, double rho_end,
-                      int steps);
+                      int steps, AlignMethod method = BOBYQA);
+
+  /**
+   * @brief Superimpose a onto b in closed form, pairing row i of a with row
+   *        i of b
+   * @param[in] a,b Containers with the same number of atoms
+   * @param[out] dx,dy,dz Displacement values
+   * @param[out] rx,ry,rz Rotation values
+   * @param[out] rmsd Root mean square distance of the pairs after the fit
+   * @return false if the sizes differ or the containers are empty
+   */
+  static bool alignByIndex(const AtomContainer& a, const AtomContainer& b,
+                           double& dx, double& dy, double& dz,
+                           double& rx, double& ry, double& rz,
+                           double& rmsd);
+
+  /**
+   * @brief Superimpose a onto b in closed form, pairing atoms with the same
+   *        name. Names missing from b or repeated in either container are
+   *        skipped.
+   * @param[in] a,b Containers
+   * @param[out] dx,dy,dz Displacement values
+   * @param[out] rx,ry,rz Rotation values
+   * @param[out] rmsd Root mean square distance of the pairs after the fit
+   * @param[out] pairs Number of atoms paired
+   * @return false if no atoms could be paired
+   */
+  static bool alignByName(const AtomContainer& a, const AtomContainer& b,
+                          double& dx, double& dy, double& dz,
+                          double& rx, double& ry, double& rz,
+                          double& rmsd, size_t& pairs);
 
   /**
    * @brief Get the displacement vectors between elements in a and the nearest element in b
@@ -108,6 +379,45 @@ public:
                             const AtomContainer& b,
                             std::vector<Matrix::Ptr>& v);
 
+private:
+  /**
+   * @brief Drop cached indices, called whenever coordinates change
+   */
+  void invalidate();
+
+  /**
+   * @brief Closed form fit of rows ra of a onto rows rb of b, see alignByIndex
+   */
+  static bool fitRows(const AtomContainer& a, const AtomContainer& b,
+                      const std::vector<size_t>& ra, const std::vector<size_t>& rb,
+                      double& dx, double& dy, double& dz,
+                      double& rx, double& ry, double& rz,
+                      double& rmsd);
+
+  /**
+   * @brief Shared body of the replicate overloads, no clipping if centre
+   *        is null
+   */
+  bool replicate(const Matrix::Mat3& lattice, long na, long nb, long nc,
+                 const double* centre, double cutoff);
+
+  /**
+   * @brief Append the given rows of this container to dest
+   */
+  void copyRows(const std::vector<size_t>& rows, AtomContainer& dest) const;
+
+  std::vector<double> x_;
+  std::vector<double> y_;
+  std::vector<double> z_;
+  std::vector<std::string> type_;
+  std::vector<std::string> name_;
+
+  bool periodic_;
+  Matrix::Mat3 lattice_;  // follows rotations applied by transform
+
+  mutable KdTree::Ptr kdtree_;
+  mutable DistanceField::Ptr field_;
+  mutable CellList::Ptr grid_;
 };
 
 #endif // ATOMCONTAINER_H
@@ -13,8 +13,16 @@
  */
 
 #include "atomcontainer_interface.h"
+#include "alignment.h"
 #include "atom_interface.h"
 #include "matrix_interface.h"
+#include "mol2.h"
+#include "screen.h"
+#include "selection.h"
+#include "trajectory.h"
+#include "xyz.h"
+#include <algorithm>
+#include <limits.h>
 
 using namespace LuaInterface;
 
@@ -43,7 +51,12 @@ int AtomContainerInterface::l_new(lua_State* L)
 
     while (lua_next(L, 1))
     {
-      ac->atoms_.push_back(luaT_to<Atom>(L, -1));
+      Atom::Ptr a = luaT_to<Atom>(L, -1);
+
+      if (a)
+      {
+        ac->add(*a);
+      }
       lua_pop(L, 1);
     }
   }
@@ -52,7 +65,7 @@ int AtomContainerInterface::l_new(lua_State* L)
   {
     if (luaT_is<Atom>(L, i))
     {
-      ac->atoms_.push_back(luaT_to<Atom>(L, i));
+      ac->add(*luaT_to<Atom>(L, i));
     }
   }
 
@@ -71,15 +84,264 @@ static int l_at(lua_State* L)
   // shifting index by -1 to convert from base 1 to base zero
   size_t idx = lua_tointeger(L, 2) - 1;
 
-  if (idx >= ac->atoms_.size())
+  if (idx >= ac->size())
   {
     return luaL_error(L, "Invalid index");
   }
 
-  luaT_push<Atom>(L, ac->atoms_.at(idx));
+  // atoms are rebuilt from the container columns, changes to the
+  // returned atom do not affect the container
+  luaT_push<Atom>(L, ac->at(idx));
   return 1;
 }
 
+static int l_coordinates(lua_State* L)
+{
+  AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
+
+  if (!ac)
+  {
+    return luaL_error(L, "AtomContainer expected");
+  }
+
+  return luaT_push(L, ac->coordinates());
+}
+
+static int l_set_coordinates(lua_State* L)
+{
+  AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
+
+  if (!ac)
+  {
+    return luaL_error(L, "AtomContainer expected");
+  }
+
+  Matrix::Ptr m = MatrixInterface::as(L, 2);
+
+  if (!ac->setCoordinates(*m))
+  {
+    return luaL_argerror(L, 2, lua_pushfstring(L, "%d x 3 Matrix expected",
+                                               (int)ac->size()));
+  }
+
+  return 0;
+}
+
+// lattice vectors are the rows of a 3 x 3 Matrix
+static int l_set_lattice(lua_State* L)
+{
+  AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
+
+  if (!ac)
+  {
+    return luaL_error(L, "AtomContainer expected");
+  }
+
+  Matrix::Ptr m = MatrixInterface::as(L, 2);
+
+  if (!m || m->nr() != 3 || m->nc() != 3)
+  {
+    return luaL_argerror(L, 2, "3 x 3 Matrix expected");
+  }
+
+  if (!ac->setLattice(Matrix::Mat3(*m)))
+  {
+    return luaL_argerror(L, 2, "lattice vectors do not span a volume");
+  }
+
+  return 0;
+}
+
+static int l_clear_lattice(lua_State* L)
+{
+  AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
+
+  if (!ac)
+  {
+    return luaL_error(L, "AtomContainer expected");
+  }
+
+  ac->clearLattice();
+  return 0;
+}
+
+// nil for containers without a lattice
+static int l_lattice(lua_State* L)
+{
+  AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
+
+  if (!ac)
+  {
+    return luaL_error(L, "AtomContainer expected");
+  }
+
+  if (!ac->periodic())
+  {
+    return 0;
+  }
+
+  return luaT_push(L, Matrix::Ptr(new Matrix::Type(ac->lattice())));
+}
+
+// number of cells along one lattice vector
+static long check_cell_count(lua_State* L, int arg)
+{
+  int isnum = 0;
+  const lua_Integer n = lua_tointegerx(L, arg, &isnum);
+
+  // bounded here so it fits a long, the supercell size is checked later
+  if (!isnum || n < 1 || n > (lua_Integer)AtomContainer::MAX_REPLICA_ROWS)
+  {
+    luaL_argerror(L, arg, lua_pushfstring(L, "cell count must be an integer from 1 to %d",
+                                          (int)AtomContainer::MAX_REPLICA_ROWS));
+  }
+
+  return (long)n;
+}
+
+// replicate(lattice, na, nb, nc, {centre = p, cutoff = r}), a nil lattice
+// uses the container's own. The options table is optional, the centre
+// defaults to the origin and needs a cutoff.
+template<int copy>
+static int l_replicate(lua_State* L)
+{
+  AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
+
+  if (!ac)
+  {
+    return luaL_error(L, "AtomContainer expected");
+  }
+
+  Matrix::Mat3 lattice = ac->lattice();
+
+  if (!lua_isnil(L, 2))
+  {
+    Matrix::Ptr m = MatrixInterface::as(L, 2);
+
+    if (!m || m->nr() != 3 || m->nc() != 3)
+    {
+      return luaL_argerror(L, 2, "3 x 3 Matrix expected");
+    }
+
+    lattice = *m;
+  }
+  else if (!ac->periodic())
+  {
+    return luaL_argerror(L, 2, "lattice expected, container has none");
+  }
+
+  const long na = check_cell_count(L, 3);
+  const long nb = check_cell_count(L, 4);
+  const long nc = check_cell_count(L, 5);
+
+  // in floating point, the product of the counts may overflow
+  if ((double)std::max(ac->size(), (size_t)1) * na * nb * nc >
+      (double)AtomContainer::MAX_REPLICA_ROWS)
+  {
+    return luaL_error(L, "supercell too large: at most %d atom copies",
+                      (int)AtomContainer::MAX_REPLICA_ROWS);
+  }
+
+  bool clip = false;
+  Matrix::Vec3 centre = dlib::zeros_matrix<double, 3, 1>();
+  double cutoff = 0;
+
+  bool have_centre = false;
+
+  if (!lua_isnoneornil(L, 6))
+  {
+    luaL_checktype(L, 6, LUA_TTABLE);
+
+    if (lua_getfield(L, 6, "centre") != LUA_TNIL)
+    {
+      have_centre = true;
+      Matrix::Ptr p = MatrixInterface::as(L, -1);
+
+      if (!p || p->size() < 3)
+      {
+        return luaL_argerror(L, 6, "centre must be a point");
+      }
+
+      centre(0) = (*p)(0);
+      centre(1) = (*p)(1);
+      centre(2) = (*p)(2);
+    }
+    lua_pop(L, 1);
+
+    if (lua_getfield(L, 6, "cutoff") != LUA_TNIL)
+    {
+      int isnum = 0;
+      cutoff = lua_tonumberx(L, -1, &isnum);
+
+      if (!isnum || !(cutoff >= 0))
+      {
+        return luaL_argerror(L, 6, "cutoff must be a non-negative number");
+      }
+
+      clip = true;
+    }
+    lua_pop(L, 1);
+
+    if (have_centre && !clip)
+    {
+      return luaL_argerror(L, 6, "centre given without a cutoff");
+    }
+  }
+
+  if (copy)
+  {
+    ac = ac->copy();
+  }
+
+  const bool ok = clip ? ac->replicate(lattice, na, nb, nc, centre, cutoff)
+                       : ac->replicate(lattice, na, nb, nc);
+
+  if (!ok)
+  {
+    return luaL_error(L, "cannot replicate: lattice vectors do not span a volume");
+  }
+
+  return copy ? luaT_push(L, ac) : 0;
+}
+
+// push a column of strings as a table
+static int push_strings(lua_State* L, const std::vector<std::string>& v)
+{
+  lua_createtable(L, v.size(), 0);
+
+  for (size_t i = 0; i < v.size(); i++)
+  {
+    lua_pushlstring(L, v[i].data(), v[i].size());
+    lua_rawseti(L, -2, i + 1);
+  }
+
+  return 1;
+}
+
+static int l_types(lua_State* L)
+{
+  AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
+
+  if (!ac)
+  {
+    return luaL_error(L, "AtomContainer expected");
+  }
+
+  return push_strings(L, ac->types());
+}
+
+static int l_names(lua_State* L)
+{
+  AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
+
+  if (!ac)
+  {
+    return luaL_error(L, "AtomContainer expected");
+  }
+
+  return push_strings(L, ac->names());
+}
+
 static int l_clear(lua_State* L)
 {
   AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
@@ -89,7 +351,7 @@ static int l_clear(lua_State* L)
     return luaL_error(L, "AtomContainer expected");
   }
 
-  ac->atoms_.clear();
+  ac->clear();
   return 0;
 }
 
@@ -121,6 +383,56 @@ static int l_near(lua_State* L)
   return 0;
 }
 
+static int l_anyWithin(lua_State* L)
+{
+  AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
+  Matrix::Ptr p = MatrixInterface::as(L, 2);
+  const double r = luaL_checknumber(L, 3);
+
+  if (!ac)
+  {
+    return luaL_error(L, "AtomContainer expected");
+  }
+
+  if (!p || p->size() < 3)
+  {
+    return luaL_error(L, "Test point expected");
+  }
+
+  lua_pushboolean(L, ac->anyWithin((*p)(0), (*p)(1), (*p)(2), r));
+  return 1;
+}
+
+static int l_within(lua_State* L)
+{
+  AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
+  Matrix::Ptr p = MatrixInterface::as(L, 2);
+  const double r = luaL_checknumber(L, 3);
+
+  if (!ac)
+  {
+    return luaL_error(L, "AtomContainer expected");
+  }
+
+  if (!p || p->size() < 3)
+  {
+    return luaL_error(L, "Test point expected");
+  }
+
+  std::vector<size_t> idx;
+  ac->withinRadius((*p)(0), (*p)(1), (*p)(2), r, idx);
+
+  lua_createtable(L, idx.size(), 0);
+
+  for (size_t i = 0; i < idx.size(); i++)
+  {
+    lua_pushinteger(L, idx[i] + 1);
+    lua_rawseti(L, -2, i + 1);
+  }
+
+  return 1;
+}
+
 static int l_intersect(lua_State* L)
 {
   AtomContainer::Ptr acSrc = luaT_to<AtomContainer>(L, 1);
@@ -152,7 +464,7 @@ static int l_size(lua_State* L)
     return luaL_error(L, "AtomContainer expected");
   }
 
-  lua_pushinteger(L, ac->atoms_.size());
+  lua_pushinteger(L, ac->size());
   return 1;
 }
 
@@ -171,7 +483,7 @@ static int l_add(lua_State* L)
     return luaL_argerror(L, 2, "Atom expected");
   }
 
-  ac->atoms_.push_back(a);
+  ac->add(*a);
   return 0;
 }
 
@@ -202,23 +514,23 @@ static int l_filter(lua_State* L)
     return 0;
   }
 
-  std::vector<Atom::Ptr> atoms;
+  std::vector<size_t> rows;
 
-  for (size_t i = 0; i < ac->atoms_.size(); i++)
+  for (size_t i = 0; i < ac->size(); i++)
   {
     lua_pushvalue(L, 2);
-    luaT_push(L, ac->atoms_[i]->copy());
+    luaT_push(L, ac->at(i));
     lua_call(L, 1, 1);
 
     if (lua_toboolean(L, -1))
     {
-      atoms.push_back(ac->atoms_[i]->copy());
+      rows.push_back(i);
     }
 
     lua_pop(L, 1);
   }
 
-  ac->atoms_ = atoms;
+  ac->keep(rows);
   return 0;
 }
 
@@ -235,6 +547,147 @@ static int l_filtered(lua_State* L)
   return 1;
 }
 
+// keep the selected rows in place or return them as a new container
+template<int copy>
+static int finish_selection(lua_State* L, AtomContainer::Ptr ac,
+                            const std::vector<size_t>& rows)
+{
+  if (copy)
+  {
+    return luaT_push(L, ac->subset(rows));
+  }
+
+  ac->keep(rows);
+  return 0;
+}
+
+// filterType("C", "N", ...)
+template<int copy>
+static int l_filter_type(lua_State* L)
+{
+  AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
+
+  if (!ac)
+  {
+    return luaL_error(L, "AtomContainer expected");
+  }
+
+  std::vector<std::string> types;
+
+  for (int i = 2; i <= lua_gettop(L); i++)
+  {
+    types.push_back(luaL_checkstring(L, i));
+  }
+
+  std::vector<size_t> rows;
+  ac->selectTypes(types, rows);
+  return finish_selection<copy>(L, ac, rows);
+}
+
+// filterTypes({"C", "N", ...})
+template<int copy>
+static int l_filter_types(lua_State* L)
+{
+  AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
+
+  if (!ac)
+  {
+    return luaL_error(L, "AtomContainer expected");
+  }
+
+  luaL_checktype(L, 2, LUA_TTABLE);
+
+  std::vector<std::string> types;
+  const lua_Integer n = luaL_len(L, 2);
+
+  for (lua_Integer i = 1; i <= n; i++)
+  {
+    lua_rawgeti(L, 2, i);
+    const char* type = lua_tostring(L, -1);
+
+    if (!type)
+    {
+      return luaL_argerror(L, 2, "table of type names expected");
+    }
+
+    types.push_back(type);
+    lua_pop(L, 1);
+  }
+
+  std::vector<size_t> rows;
+  ac->selectTypes(types, rows);
+  return finish_selection<copy>(L, ac, rows);
+}
+
+// filterName("C*")
+template<int copy>
+static int l_filter_name(lua_State* L)
+{
+  AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
+
+  if (!ac)
+  {
+    return luaL_error(L, "AtomContainer expected");
+  }
+
+  const char* pattern = luaL_checkstring(L, 2);
+
+  std::vector<size_t> rows;
+  ac->selectName(pattern, rows);
+  return finish_selection<copy>(L, ac, rows);
+}
+
+// select("type C and within 4 of ligand" [, {ligand = ac}])
+// names in "within" clauses are looked up in the optional table, then in
+// the globals
+template<int copy>
+static int l_select(lua_State* L)
+{
+  AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
+
+  if (!ac)
+  {
+    return luaL_error(L, "AtomContainer expected");
+  }
+
+  Selection selection;
+
+  if (!selection.compile(luaL_checkstring(L, 2)))
+  {
+    return luaL_error(L, "select: %s", selection.error().c_str());
+  }
+
+  const bool have_refs = lua_istable(L, 3);
+
+  for (size_t i = 0; i < selection.references().size(); i++)
+  {
+    const std::string& name = selection.references()[i];
+
+    if (!have_refs || lua_getfield(L, 3, name.c_str()) == LUA_TNIL)
+    {
+      if (have_refs)
+      {
+        lua_pop(L, 1);
+      }
+      lua_getglobal(L, name.c_str());
+    }
+
+    AtomContainer::Ptr ref = luaT_to<AtomContainer>(L, -1);
+
+    if (!ref)
+    {
+      return luaL_error(L, "select: '%s' is not an AtomContainer", name.c_str());
+    }
+
+    selection.bind(name, ref);
+    lua_pop(L, 1);
+  }
+
+  std::vector<size_t> rows;
+  selection.evaluate(*ac, rows);
+  return finish_selection<copy>(L, ac, rows);
+}
+
 static void get_number(lua_State* L, int tab_idx, const char* key, double& dest)
 {
   if (lua_getfield(L, tab_idx, key) != LUA_TNIL)
@@ -244,11 +697,31 @@ static void get_number(lua_State* L, int tab_idx, const char* key, double& dest)
   lua_pop(L, 1);
 }
 
-static void get_number(lua_State* L, int tab_idx, const char* key, int& dest)
+// whole numbers from min up, anything else is an argument error rather than
+// being truncated or wrapped
+static void get_integer(lua_State* L, int tab_idx, const char* key, int& dest, int min)
+{
+  if (lua_getfield(L, tab_idx, key) != LUA_TNIL)
+  {
+    int isnum = 0;
+    const lua_Integer v = lua_tointegerx(L, -1, &isnum);
+
+    if (!isnum || v < min || v > INT_MAX)
+    {
+      luaL_argerror(L, tab_idx,
+                    lua_pushfstring(L, "'%s' must be an integer of at least %d", key, min));
+    }
+
+    dest = (int)v;
+  }
+  lua_pop(L, 1);
+}
+
+static void get_string(lua_State* L, int tab_idx, const char* key, std::string& dest)
 {
   if (lua_getfield(L, tab_idx, key) != LUA_TNIL)
   {
-    dest = lua_tointeger(L, -1);
+    dest = lua_tostring(L, -1);
   }
   lua_pop(L, 1);
 }
@@ -345,46 +818,73 @@ static int l_displacements(lua_State* L)
 }
 
 
-static int l_align(lua_State* L)
+// alignment settings read from option tables
+struct AlignSettings
 {
-  AtomContainer::Ptr ac1 = luaT_to<AtomContainer>(L, 1);
-  AtomContainer::Ptr ac2 = luaT_to<AtomContainer>(L, 2);
-
-  if (!ac1 || !ac2)
+  AlignSettings()
+    : X(6, 0), steps(200), rho_begin(1e1), rho_end(1e-3),
+      method(AtomContainer::BOBYQA), starts(1), top(0),
+      field(0), field_margin(5)
   {
-    return luaL_error(L, "Atom containers expected");
   }
 
   std::vector<double> X;
-  X.resize(6, 0);
-
-  int steps = 200;
-  double rho_begin = 1e1;
-  double rho_end = 1e-3;
+  int steps;
+  double rho_begin;
+  double rho_end;
+  AtomContainer::AlignMethod method;
+  int starts;
+  int top;
+  double field;  // distance field spacing, 0 for exact searches
+  double field_margin;
+};
+
+// read settings from every table at or after index first
+static void get_align_settings(lua_State* L, int first, AlignSettings& settings)
+{
+  std::string method;
 
   // letting the user supply multiple tables with params
-  for (int i = 3; i <= lua_gettop(L); i++)
+  for (int i = first; i <= lua_gettop(L); i++)
   {
     if (lua_istable(L, i))
     {
-      get_number(L, i, "dx", X[0]);
-      get_number(L, i, "dy", X[1]);
-      get_number(L, i, "dz", X[2]);
-
-      get_number(L, i, "rx", X[3]);
-      get_number(L, i, "ry", X[3]);
-      get_number(L, i, "rz", X[5]);
-
-      get_number(L, i, "rho_begin", rho_begin);
-      get_number(L, i, "rho_end", rho_end);
-      get_number(L, i, "steps", steps);
+      get_number(L, i, "dx", settings.X[0]);
+      get_number(L, i, "dy", settings.X[1]);
+      get_number(L, i, "dz", settings.X[2]);
+
+      get_number(L, i, "rx", settings.X[3]);
+      get_number(L, i, "ry", settings.X[4]);
+      get_number(L, i, "rz", settings.X[5]);
+
+      get_number(L, i, "rho_begin", settings.rho_begin);
+      get_number(L, i, "rho_end", settings.rho_end);
+      get_integer(L, i, "steps", settings.steps, 1);
+      get_integer(L, i, "starts", settings.starts, 1);
+      get_integer(L, i, "top", settings.top, 0);
+      get_number(L, i, "field", settings.field);
+      get_number(L, i, "fieldMargin", settings.field_margin);
+      get_string(L, i, "method", method);
     }
   }
 
-  double diff = AtomContainer::align(ac1, ac2,
-                                     X[0], X[1], X[2], X[3], X[4], X[5],
-                                     rho_begin, rho_end, steps);
+  if (method == "icp")
+  {
+    settings.method = AtomContainer::ICP;
+  }
+  else if (method == "lbfgs")
+  {
+    settings.method = AtomContainer::LBFGS;
+  }
+  else if (!method.empty() && method != "bobyqa")
+  {
+    luaL_error(L, "Unknown alignment method `%s'", method.c_str());
+  }
+}
 
+// push a table with transform parameters and the residual
+static void push_transform(lua_State* L, const double* X, double diff)
+{
   lua_newtable(L);
   const int tab_pos = lua_gettop(L);
 
@@ -408,10 +908,424 @@ static int l_align(lua_State* L)
 
   lua_pushnumber(L, diff);
   lua_setfield(L, tab_pos, "diff");
+}
+
+static void push_transform(lua_State* L, const Alignment::Result& r)
+{
+  const double X[6] = {r.X(0), r.X(1), r.X(2), r.X(3), r.X(4), r.X(5)};
+  push_transform(L, X, r.diff);
+}
+
+static int l_align(lua_State* L)
+{
+  AtomContainer::Ptr ac1 = luaT_to<AtomContainer>(L, 1);
+  AtomContainer::Ptr ac2 = luaT_to<AtomContainer>(L, 2);
+
+  if (!ac1 || !ac2)
+  {
+    return luaL_error(L, "Atom containers expected");
+  }
+
+  AlignSettings settings;
+  get_align_settings(L, 3, settings);
+  std::vector<double>& X = settings.X;
+
+  if (settings.starts <= 1 && settings.top <= 0 && settings.field <= 0)
+  {
+    double diff = AtomContainer::align(ac1, ac2,
+                                       X[0], X[1], X[2], X[3], X[4], X[5],
+                                       settings.rho_begin, settings.rho_end,
+                                       settings.steps, settings.method);
+
+    push_transform(L, &X[0], diff);
+    return 1;
+  }
+
+  // global search, the supplied transform is one of the starting points
+  Alignment::Params X0(6);
+
+  for (int i = 0; i < 6; i++)
+  {
+    X0(i) = X[i];
+  }
+
+  std::vector<Alignment::Result> results;
+
+  Alignment session(ac1, ac2);
+  session.useDistanceField(settings.field, settings.field_margin);
+  session.multiStart(X0, std::max(settings.starts, 1), settings.method,
+                     settings.rho_begin, settings.rho_end, settings.steps,
+                     results);
+
+  push_transform(L, results[0]);
+
+  if (settings.top <= 0)
+  {
+    return 1;
+  }
+
+  // distinct results, best first
+  lua_newtable(L);
+
+  for (size_t i = 0; i < results.size() && (int)i < settings.top; i++)
+  {
+    lua_pushinteger(L, i + 1);
+    push_transform(L, results[i]);
+    lua_settable(L, -3);
+  }
+
+  return 2;
+}
+
+// alignByIndex(a, b) and alignByName(a, b) return the transform moving a
+// onto b, with the usual nearest neighbour diff, and the rmsd of the paired
+// atoms
+template<int by_name>
+static int l_align_closed_form(lua_State* L)
+{
+  AtomContainer::Ptr ac1 = luaT_to<AtomContainer>(L, 1);
+  AtomContainer::Ptr ac2 = luaT_to<AtomContainer>(L, 2);
+
+  if (!ac1 || !ac2)
+  {
+    return luaL_error(L, "Atom containers expected");
+  }
+
+  double X[6];
+  double rmsd;
+  size_t pairs;
+  bool ok;
+
+  if (by_name)
+  {
+    ok = AtomContainer::alignByName(*ac1, *ac2, X[0], X[1], X[2],
+                                    X[3], X[4], X[5], rmsd, pairs);
+  }
+  else
+  {
+    ok = AtomContainer::alignByIndex(*ac1, *ac2, X[0], X[1], X[2],
+                                     X[3], X[4], X[5], rmsd);
+  }
+
+  if (!ok)
+  {
+    return luaL_error(L, by_name ? "No atom names in common" :
+                                   "Containers must have the same number of atoms");
+  }
+
+  // diff is the same nearest neighbour objective align, pairwiseAlign and
+  // screen report so the results can be compared, rmsd only covers the pairs
+  Alignment::Params P(6);
+
+  for (int i = 0; i < 6; i++)
+  {
+    P(i) = X[i];
+  }
+
+  push_transform(L, X, Alignment(ac1, ac2).objective(P));
+  lua_pushnumber(L, rmsd);
+  return 2;
+}
+
+// pairwiseAlign({ac1, ac2, ...}, settings) returns a symmetric Matrix of
+// alignment residuals
+static int l_pairwise_align(lua_State* L)
+{
+  luaL_checktype(L, 1, LUA_TTABLE);
+
+  std::vector<AtomContainer::Ptr> list;
+  const lua_Integer n = luaL_len(L, 1);
+
+  for (lua_Integer i = 1; i <= n; i++)
+  {
+    lua_rawgeti(L, 1, i);
+    AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, -1);
+    lua_pop(L, 1);
+
+    if (!ac)
+    {
+      return luaL_argerror(L, 1, "list of AtomContainers expected");
+    }
+
+    list.push_back(ac);
+  }
+
+  AlignSettings settings;
+  get_align_settings(L, 2, settings);
+
+  Alignment::Params X0(6);
+
+  for (int i = 0; i < 6; i++)
+  {
+    X0(i) = settings.X[i];
+  }
+
+  Matrix::Ptr residuals(new Matrix::Type);
+  Alignment::pairwise(list, X0, std::max(settings.starts, 1), settings.method,
+                      settings.rho_begin, settings.rho_end, settings.steps,
+                      settings.field, settings.field_margin, *residuals);
+
+  return luaT_push(L, residuals);
+}
+
+// screen(reference, {candidate1, candidate2, ...}, settings) returns a list
+// of transforms, best first, each with the index of its candidate
+static int l_screen(lua_State* L)
+{
+  AtomContainer::Ptr reference = luaT_to<AtomContainer>(L, 1);
+
+  if (!reference)
+  {
+    return luaL_argerror(L, 1, "AtomContainer expected");
+  }
+
+  luaL_checktype(L, 2, LUA_TTABLE);
+
+  std::vector<AtomContainer::Ptr> candidates;
+  const lua_Integer n = luaL_len(L, 2);
+
+  for (lua_Integer i = 1; i <= n; i++)
+  {
+    lua_rawgeti(L, 2, i);
+    AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, -1);
+    lua_pop(L, 1);
+
+    if (!ac)
+    {
+      return luaL_argerror(L, 2, "list of AtomContainers expected");
+    }
+
+    candidates.push_back(ac);
+  }
+
+  AlignSettings settings;
+  settings.starts = 0;  // principal axes seeds are always tried
+  get_align_settings(L, 3, settings);
+
+  Alignment::Params X0(6);
+
+  for (int i = 0; i < 6; i++)
+  {
+    X0(i) = settings.X[i];
+  }
+
+  Screen screen(reference);
+  screen.useDistanceField(settings.field, settings.field_margin);
+
+  std::vector<Screen::Hit> hits;
+  screen.run(candidates, X0, std::max(settings.starts, 0), settings.method,
+             settings.rho_begin, settings.rho_end, settings.steps, hits);
+
+  lua_newtable(L);
+
+  for (size_t i = 0; i < hits.size(); i++)
+  {
+    if (settings.top > 0 && (int)i >= settings.top)
+    {
+      break;
+    }
+
+    Alignment::Result r;
+    r.X = hits[i].X;
+    r.diff = hits[i].diff;
+    push_transform(L, r);
+
+    lua_pushinteger(L, hits[i].index + 1);
+    lua_setfield(L, -2, "index");
+
+    lua_rawseti(L, -2, i + 1);
+  }
+
+  return 1;
+}
+
+// alignTrajectory(reference, input, output, settings) aligns every frame of
+// a multi-frame XYZ file and returns the per frame residuals. Frames are
+// fitted row by row unless settings.fit is "nearest". output may be nil.
+static int l_align_trajectory(lua_State* L)
+{
+  AtomContainer::Ptr reference = luaT_to<AtomContainer>(L, 1);
+
+  if (!reference)
+  {
+    return luaL_argerror(L, 1, "AtomContainer expected");
+  }
+
+  const char* input = luaL_checkstring(L, 2);
+  const char* output = luaL_optstring(L, 3, "");
+
+  AlignSettings settings;
+  get_align_settings(L, 4, settings);
+
+  std::string fit;
+
+  if (lua_istable(L, 4))
+  {
+    get_string(L, 4, "fit", fit);
+  }
+
+  TrajectoryAligner::Mode mode = TrajectoryAligner::BY_INDEX;
+
+  if (fit == "nearest")
+  {
+    mode = TrajectoryAligner::NEAREST;
+  }
+  else if (!fit.empty() && fit != "index")
+  {
+    return luaL_error(L, "Unknown trajectory fit `%s'", fit.c_str());
+  }
+
+  Alignment::Params X0(6);
+
+  for (int i = 0; i < 6; i++)
+  {
+    X0(i) = settings.X[i];
+  }
+
+  TrajectoryAligner aligner(reference);
+  std::vector<double> residuals;
+
+  if (!aligner.run(input, output, mode, X0, settings.method,
+                   settings.rho_begin, settings.rho_end, settings.steps,
+                   residuals))
+  {
+    return luaL_error(L, "%s", aligner.error().c_str());
+  }
+
+  lua_createtable(L, residuals.size(), 0);
+
+  for (size_t i = 0; i < residuals.size(); i++)
+  {
+    lua_pushnumber(L, residuals[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
 
   return 1;
 }
 
+static int l_loadxyz(lua_State* L)
+{
+  const char* filename = lua_tostring(L, 1);
+
+  if (!filename)
+  {
+    return luaL_argerror(L, 1, "File name expected");
+  }
+
+  XYZReader reader;
+  AtomContainer::Ptr ac(new AtomContainer());
+  std::string comment;
+
+  if (!reader.open(filename) || !reader.next(*ac, comment))
+  {
+    if (reader.error().empty())
+    {
+      return luaL_error(L, "%s: no atoms found", filename);
+    }
+    return luaL_error(L, "%s", reader.error().c_str());
+  }
+
+  luaT_push(L, ac);
+  lua_pushstring(L, comment.c_str());
+  return 2;
+}
+
+// push a table of bonds, each bond is {atom1, atom2} with 1 based rows
+static void push_bonds(lua_State* L, const std::vector<Mol2Reader::Bond>& bonds)
+{
+  lua_createtable(L, bonds.size(), 0);
+
+  for (size_t i = 0; i < bonds.size(); i++)
+  {
+    lua_createtable(L, 2, 0);
+    lua_pushinteger(L, bonds[i].a + 1);
+    lua_rawseti(L, -2, 1);
+    lua_pushinteger(L, bonds[i].b + 1);
+    lua_rawseti(L, -2, 2);
+    lua_rawseti(L, -2, i + 1);
+  }
+}
+
+static int l_loadmol2(lua_State* L)
+{
+  const char* filename = lua_tostring(L, 1);
+
+  if (!filename)
+  {
+    return luaL_argerror(L, 1, "File name expected");
+  }
+
+  Mol2Reader reader;
+  AtomContainer::Ptr ac(new AtomContainer());
+  std::vector<Mol2Reader::Bond> bonds;
+  std::string name;
+
+  if (!reader.open(filename) || !reader.next(*ac, bonds, name))
+  {
+    if (reader.error().empty())
+    {
+      return luaL_error(L, "%s: no molecule found", filename);
+    }
+    return luaL_error(L, "%s", reader.error().c_str());
+  }
+
+  luaT_push(L, ac);
+  push_bonds(L, bonds);
+  lua_pushstring(L, name.c_str());
+  return 3;
+}
+
+static int l_loadmol2all(lua_State* L)
+{
+  const char* filename = lua_tostring(L, 1);
+
+  if (!filename)
+  {
+    return luaL_argerror(L, 1, "File name expected");
+  }
+
+  Mol2Reader reader;
+
+  if (!reader.open(filename))
+  {
+    return luaL_error(L, "%s", reader.error().c_str());
+  }
+
+  lua_newtable(L);  // containers
+  lua_newtable(L);  // bonds
+  lua_newtable(L);  // names
+  const int names_pos = lua_gettop(L);
+
+  std::vector<Mol2Reader::Bond> bonds;
+  std::string name;
+
+  for (int i = 1; true; i++)
+  {
+    AtomContainer::Ptr ac(new AtomContainer());
+
+    if (!reader.next(*ac, bonds, name))
+    {
+      break;
+    }
+
+    luaT_push(L, ac);
+    lua_rawseti(L, names_pos - 2, i);
+
+    push_bonds(L, bonds);
+    lua_rawseti(L, names_pos - 1, i);
+
+    lua_pushstring(L, name.c_str());
+    lua_rawseti(L, names_pos, i);
+  }
+
+  if (!reader.error().empty())
+  {
+    return luaL_error(L, "%s", reader.error().c_str());
+  }
+
+  return 3;
+}
+
 static int l_tostring(lua_State* L)
 {
   AtomContainer::Ptr ac = luaT_to<AtomContainer>(L, 1);
@@ -419,10 +1333,10 @@ static int l_tostring(lua_State* L)
   std::string s = "AtomContainer({";
 
   lua_getglobal(L, "tostring");
-  for (size_t i = 0; i < ac->atoms_.size(); i++)
+  for (size_t i = 0; i < ac->size(); i++)
   {
     lua_pushvalue(L, -1);
-    luaT_push(L, ac->atoms_[i]);
+    luaT_push(L, ac->at(i));
     lua_call(L, 1, 1);
 
     if (i)
@@ -446,15 +1360,36 @@ std::vector<luaL_Reg> AtomContainerInterface::luaMethods()
 
   methods.push_back(luaL_toreg("at", l_at));
   methods.push_back(luaL_toreg("clear", l_clear));
+  methods.push_back(luaL_toreg("coordinates", l_coordinates));
+  methods.push_back(luaL_toreg("setCoordinates", l_set_coordinates));
+  methods.push_back(luaL_toreg("setLattice", l_set_lattice));
+  methods.push_back(luaL_toreg("clearLattice", l_clear_lattice));
+  methods.push_back(luaL_toreg("lattice", l_lattice));
+  methods.push_back(luaL_toreg("replicate", l_replicate<0>));
+  methods.push_back(luaL_toreg("replicated", l_replicate<1>));
+  methods.push_back(luaL_toreg("types", l_types));
+  methods.push_back(luaL_toreg("names", l_names));
   methods.push_back(luaL_toreg("near", l_near));
+  methods.push_back(luaL_toreg("anyWithin", l_anyWithin));
+  methods.push_back(luaL_toreg("within", l_within));
   methods.push_back(luaL_toreg("size", l_size));
   methods.push_back(luaL_toreg("add", l_add));
   methods.push_back(luaL_toreg("copy", l_copy));
   methods.push_back(luaL_toreg("closestDistanceSquared", l_closest_dist_squared));
   methods.push_back(luaL_toreg("align", l_align));
+  methods.push_back(luaL_toreg("alignByIndex", l_align_closed_form<0>));
+  methods.push_back(luaL_toreg("alignByName", l_align_closed_form<1>));
 
   methods.push_back(luaL_toreg("filter", l_filter));
   methods.push_back(luaL_toreg("filtered", l_filtered));
+  methods.push_back(luaL_toreg("filterType", l_filter_type<0>));
+  methods.push_back(luaL_toreg("filteredType", l_filter_type<1>));
+  methods.push_back(luaL_toreg("filterTypes", l_filter_types<0>));
+  methods.push_back(luaL_toreg("filteredTypes", l_filter_types<1>));
+  methods.push_back(luaL_toreg("filterName", l_filter_name<0>));
+  methods.push_back(luaL_toreg("filteredName", l_filter_name<1>));
+  methods.push_back(luaL_toreg("select", l_select<0>));
+  methods.push_back(luaL_toreg("selected", l_select<1>));
 
   methods.push_back(luaL_toreg("transform", l_transform<1>));
   methods.push_back(luaL_toreg("transformed", l_transformed<1>));
@@ -481,6 +1416,14 @@ std::vector<luaL_Reg> AtomContainerInterface::luaFunctions()
   functions.push_back(luaL_toreg("closestDistanceSquared", l_closest_dist_squared));
   functions.push_back(luaL_toreg("displacements", l_displacements));
   functions.push_back(luaL_toreg("align", l_align));
+  functions.push_back(luaL_toreg("pairwiseAlign", l_pairwise_align));
+  functions.push_back(luaL_toreg("alignByIndex", l_align_closed_form<0>));
+  functions.push_back(luaL_toreg("alignByName", l_align_closed_form<1>));
+  functions.push_back(luaL_toreg("screen", l_screen));
+  functions.push_back(luaL_toreg("alignTrajectory", l_align_trajectory));
+  functions.push_back(luaL_toreg("loadXYZ", l_loadxyz));
+  functions.push_back(luaL_toreg("loadMol2", l_loadmol2));
+  functions.push_back(luaL_toreg("loadMol2All", l_loadmol2all));
 
   return functions;
 }
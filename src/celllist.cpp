@@ -0,0 +1,267 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      celllist.cpp
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include "celllist.h"
+#include <algorithm>
+#include <math.h>
+
+// number of cells needed to cover the extents with a given cell size
+static double cellCount(const double extent[3], double cell_size)
+{
+  double count = 1;
+
+  for (int i = 0; i < 3; i++)
+  {
+    count *= floor(extent[i] / cell_size) + 1;
+  }
+
+  return count;
+}
+
+CellList::CellList()
+  : cell_size_(1), requested_cell_size_(0)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    origin_[i] = 0;
+    dims_[i] = 1;
+  }
+}
+
+void CellList::build(const double* x, const double* y, const double* z, size_t n,
+                     double cell_size)
+{
+  const double* cols[3] = {x, y, z};
+  double extent[3] = {0, 0, 0};
+  double max_extent = 0;
+
+  requested_cell_size_ = cell_size;
+
+  for (int a = 0; a < 3; a++)
+  {
+    origin_[a] = 0;
+
+    if (n)
+    {
+      const double lo = *std::min_element(cols[a], cols[a] + n);
+      const double hi = *std::max_element(cols[a], cols[a] + n);
+      origin_[a] = lo;
+      extent[a] = hi - lo;
+      max_extent = std::max(max_extent, extent[a]);
+    }
+  }
+
+  // upper bound on the number of cells, keeps memory linear in n when the
+  // requested cell size is small compared to the extents
+  const double max_cells = 8.0 * n + 64;
+
+  if (max_extent <= 0)
+  {
+    cell_size_ = cell_size > 0 ? cell_size : 1;
+  }
+  else if (cell_size > 0)
+  {
+    cell_size_ = cell_size;
+
+    while (cellCount(extent, cell_size_) > max_cells)
+    {
+      cell_size_ *= 2;
+    }
+  }
+  else
+  {
+    // bisect for the smallest cell size giving at most one cell per point
+    double lo = max_extent / (2.0 * (n + 1));
+    double hi = max_extent + 1;
+
+    for (int i = 0; i < 64; i++)
+    {
+      const double mid = 0.5 * (lo + hi);
+
+      if (cellCount(extent, mid) > n)
+      {
+        lo = mid;
+      }
+      else
+      {
+        hi = mid;
+      }
+    }
+
+    cell_size_ = hi;
+  }
+
+  for (int a = 0; a < 3; a++)
+  {
+    dims_[a] = (long)floor(extent[a] / cell_size_) + 1;
+  }
+
+  const size_t num_cells = dims_[0] * dims_[1] * dims_[2];
+
+  // counting sort of the points by cell
+  std::vector<size_t> cell_of(n);
+  start_.assign(num_cells + 1, 0);
+
+  for (size_t i = 0; i < n; i++)
+  {
+    const long cx = cellCoord(x[i], 0);
+    const long cy = cellCoord(y[i], 1);
+    const long cz = cellCoord(z[i], 2);
+
+    cell_of[i] = (cz * dims_[1] + cy) * dims_[0] + cx;
+    start_[cell_of[i] + 1]++;
+  }
+
+  for (size_t c = 0; c < num_cells; c++)
+  {
+    start_[c + 1] += start_[c];
+  }
+
+  std::vector<size_t> fill(start_.begin(), start_.end() - 1);
+
+  index_.resize(n);
+  x_.resize(n);
+  y_.resize(n);
+  z_.resize(n);
+
+  for (size_t i = 0; i < n; i++)
+  {
+    const size_t k = fill[cell_of[i]]++;
+    index_[k] = i;
+    x_[k] = x[i];
+    y_[k] = y[i];
+    z_[k] = z[i];
+  }
+}
+
+long CellList::cellCoord(double p, int axis) const
+{
+  const long c = (long)floor((p - origin_[axis]) / cell_size_);
+  return std::min(std::max(c, 0L), dims_[axis] - 1);
+}
+
+bool CellList::anyWithin(double px, double py, double pz, double r) const
+{
+  long lo[3];
+  long hi[3];
+
+  if (!cellRange(px, r, 0, lo[0], hi[0]) ||
+      !cellRange(py, r, 1, lo[1], hi[1]) ||
+      !cellRange(pz, r, 2, lo[2], hi[2]))
+  {
+    return false;
+  }
+
+  const double r2 = r * r;
+
+  for (long k = lo[2]; k <= hi[2]; k++)
+  {
+    for (long j = lo[1]; j <= hi[1]; j++)
+    {
+      const size_t row = (k * dims_[1] + j) * dims_[0];
+
+      // cells of a row are contiguous, scan them as one range
+      for (size_t m = start_[row + lo[0]]; m < start_[row + hi[0] + 1]; m++)
+      {
+        const double ex = px - x_[m];
+        const double ey = py - y_[m];
+        const double ez = pz - z_[m];
+
+        if (ex * ex + ey * ey + ez * ez <= r2)
+        {
+          return true;
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+size_t CellList::withinRadius(double px, double py, double pz, double r,
+                              std::vector<size_t>& idx) const
+{
+  long lo[3];
+  long hi[3];
+
+  if (!cellRange(px, r, 0, lo[0], hi[0]) ||
+      !cellRange(py, r, 1, lo[1], hi[1]) ||
+      !cellRange(pz, r, 2, lo[2], hi[2]))
+  {
+    return 0;
+  }
+
+  const double r2 = r * r;
+  const size_t first = idx.size();
+
+  for (long k = lo[2]; k <= hi[2]; k++)
+  {
+    for (long j = lo[1]; j <= hi[1]; j++)
+    {
+      const size_t row = (k * dims_[1] + j) * dims_[0];
+
+      for (size_t m = start_[row + lo[0]]; m < start_[row + hi[0] + 1]; m++)
+      {
+        const double ex = px - x_[m];
+        const double ey = py - y_[m];
+        const double ez = pz - z_[m];
+
+        if (ex * ex + ey * ey + ez * ez <= r2)
+        {
+          idx.push_back(index_[m]);
+        }
+      }
+    }
+  }
+
+  std::sort(idx.begin() + first, idx.end());
+  return idx.size() - first;
+}
+
+size_t CellList::size() const
+{
+  return index_.size();
+}
+
+double CellList::cellSize() const
+{
+  return cell_size_;
+}
+
+double CellList::requestedCellSize() const
+{
+  return requested_cell_size_;
+}
+
+bool CellList::cellRange(double p, double r, int axis, long& lo, long& hi) const
+{
+  if (index_.empty() || !(r >= 0))
+  {
+    return false;
+  }
+
+  // clamp in floating point first, the interval may be far off the grid
+  const double last = dims_[axis] - 1;
+  const double a = floor((p - r - origin_[axis]) / cell_size_);
+  const double b = floor((p + r - origin_[axis]) / cell_size_);
+
+  if (!(b >= 0 && a <= last))
+  {
+    return false;
+  }
+
+  lo = (long)std::max(a, 0.0);
+  hi = (long)std::min(b, last);
+  return true;
+}
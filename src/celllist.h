@@ -0,0 +1,99 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      celllist.h
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef CELLLIST_H
+#define CELLLIST_H
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <stddef.h>
+
+/**
+ * Uniform grid over a set of points. Points are bucketed by cell and stored
+ * cell by cell so that a query only touches the cells around it.
+ */
+class CellList
+{
+public:
+  typedef boost::shared_ptr<CellList> Ptr;
+
+  CellList();
+
+  /**
+   * @brief Build the grid over a set of points
+   * @param x,y,z Coordinate columns, n entries each
+   * @param n Number of points
+   * @param cell_size Edge length of a cell, a size is picked to give about
+   *        one point per cell if this is not positive
+   */
+  void build(const double* x, const double* y, const double* z, size_t n,
+             double cell_size = 0);
+
+  /**
+   * @brief Test whether any point lies within r of p, stops at the first one
+   * @param px,py,pz Query point
+   * @param r Radius, points at exactly r count
+   * @return true if a point was found
+   */
+  bool anyWithin(double px, double py, double pz, double r) const;
+
+  /**
+   * @brief Find every point within r of p
+   * @param[in] px,py,pz Query point
+   * @param[in] r Radius, points at exactly r count
+   * @param[out] idx Indices into the build arrays are appended, in
+   *             increasing order
+   * @return number of points appended
+   */
+  size_t withinRadius(double px, double py, double pz, double r,
+                      std::vector<size_t>& idx) const;
+
+  /**
+   * @brief Number of points in the grid
+   */
+  size_t size() const;
+
+  /**
+   * @brief Edge length of a cell
+   */
+  double cellSize() const;
+
+  /**
+   * @brief Cell size passed to build(), cellSize() may be larger
+   */
+  double requestedCellSize() const;
+
+private:
+  long cellCoord(double p, int axis) const;
+
+  /**
+   * @brief Cells along an axis overlapping [p - r, p + r]
+   * @return false if the interval misses the grid
+   */
+  bool cellRange(double p, double r, int axis, long& lo, long& hi) const;
+
+  double origin_[3];
+  long dims_[3];
+  double cell_size_;
+  double requested_cell_size_;
+
+  // points sorted by cell, cell c holds entries [start_[c], start_[c+1])
+  std::vector<size_t> start_;
+  std::vector<size_t> index_;
+  std::vector<double> x_;
+  std::vector<double> y_;
+  std::vector<double> z_;
+};
+
+#endif // CELLLIST_H
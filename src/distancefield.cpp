@@ -0,0 +1,122 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      distancefield.cpp
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include "distancefield.h"
+#include "kdtree.h"
+#include "threadpool.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+
+DistanceField::DistanceField()
+  : spacing_(1), inv_spacing_(1), requested_spacing_(1), margin_(0)
+{
+  for (int a = 0; a < 3; a++)
+  {
+    origin_[a] = 0;
+    dims_[a] = 0;
+  }
+}
+
+void DistanceField::build(const KdTree& tree,
+                          const double* x, const double* y, const double* z,
+                          size_t n, double spacing, double margin,
+                          size_t max_samples)
+{
+  requested_spacing_ = spacing;
+  margin_ = margin;
+  values_.clear();
+
+  if (n == 0 || spacing <= 0)
+  {
+    return;
+  }
+
+  const double* cols[3] = {x, y, z};
+  double extent[3];
+
+  for (int a = 0; a < 3; a++)
+  {
+    const double lo = *std::min_element(cols[a], cols[a] + n);
+    const double hi = *std::max_element(cols[a], cols[a] + n);
+    origin_[a] = lo - margin;
+    extent[a] = hi - lo + 2 * margin;
+  }
+
+  spacing_ = spacing;
+
+  while (true)
+  {
+    double count = 1;
+
+    // at least two samples per axis so every query has a cell
+    for (int a = 0; a < 3; a++)
+    {
+      dims_[a] = std::max(2L, (long)ceil(extent[a] / spacing_) + 1);
+      count *= dims_[a];
+    }
+
+    if (count <= std::max(max_samples, (size_t)8))
+    {
+      break;
+    }
+
+    spacing_ *= 2;
+  }
+
+  inv_spacing_ = 1.0 / spacing_;
+  values_.resize(dims_[0] * dims_[1] * dims_[2]);
+
+  ThreadPool::shared().parallelFor(
+        dims_[2], boost::bind(&DistanceField::buildSlice, this, _1, &tree));
+}
+
+void DistanceField::buildSlice(size_t k, const KdTree* tree)
+{
+  const double pz = origin_[2] + k * spacing_;
+
+  for (long j = 0; j < dims_[1]; j++)
+  {
+    const double py = origin_[1] + j * spacing_;
+    float* row = &values_[(k * dims_[1] + j) * dims_[0]];
+
+    for (long i = 0; i < dims_[0]; i++)
+    {
+      size_t idx;
+      double dist2;
+
+      tree->nearest(origin_[0] + i * spacing_, py, pz, idx, dist2);
+      row[i] = (float)dist2;
+    }
+  }
+}
+
+double DistanceField::requestedSpacing() const
+{
+  return requested_spacing_;
+}
+
+double DistanceField::margin() const
+{
+  return margin_;
+}
+
+double DistanceField::spacing() const
+{
+  return spacing_;
+}
+
+size_t DistanceField::samples() const
+{
+  return values_.size();
+}
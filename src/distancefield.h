@@ -0,0 +1,149 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      distancefield.h
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef DISTANCEFIELD_H
+#define DISTANCEFIELD_H
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <math.h>
+#include <stddef.h>
+
+class KdTree;
+
+/**
+ * Squared distance to the nearest point of a set, sampled on a regular grid
+ * covering the bounding box of the points plus a margin. Lookups are
+ * trilinear interpolations of the samples so they cost the same no matter
+ * how many points the set has. Inside the grid the interpolated value is
+ * at most 3/4 spacing^2 above the exact squared distance; it can fall
+ * further below it where two points are about equally near. Outside the
+ * grid the value keeps growing with the distance to the grid.
+ *
+ * The field is immutable once built so it can be shared between threads.
+ */
+class DistanceField
+{
+public:
+  typedef boost::shared_ptr<DistanceField> Ptr;
+
+  DistanceField();
+
+  /**
+   * @brief Sample the squared distance to the points of a tree
+   * @param tree Points to measure against
+   * @param x,y,z Coordinate columns the tree was built from, n entries each
+   * @param n Number of points
+   * @param spacing Requested distance between samples
+   * @param margin Padding added around the bounding box of the points
+   * @param max_samples The spacing is doubled until the grid has at most
+   *        this many samples (4 bytes each)
+   */
+  void build(const KdTree& tree,
+             const double* x, const double* y, const double* z, size_t n,
+             double spacing, double margin, size_t max_samples);
+
+  /**
+   * @brief Interpolated squared distance to the nearest point
+   * @param px,py,pz Query point
+   * @return squared distance, 0 if the field was built over no points
+   */
+  double value(double px, double py, double pz) const
+  {
+    if (values_.empty())
+    {
+      return 0;
+    }
+
+    const double p[3] = {px, py, pz};
+    long c[3];
+    double t[3];
+    double outside2 = 0;
+
+    for (int a = 0; a < 3; a++)
+    {
+      double f = (p[a] - origin_[a]) * inv_spacing_;
+
+      if (f < 0 || f > dims_[a] - 1)
+      {
+        const double clamped = f < 0 ? 0 : dims_[a] - 1;
+        const double e = (f - clamped) * spacing_;
+        outside2 += e * e;
+        f = clamped;
+      }
+
+      c[a] = (long)f;
+
+      if (c[a] > dims_[a] - 2)
+      {
+        c[a] = dims_[a] - 2;
+      }
+
+      t[a] = f - c[a];
+    }
+
+    const float* v = &values_[(c[2] * dims_[1] + c[1]) * dims_[0] + c[0]];
+    const long sy = dims_[0];
+    const long sz = dims_[0] * dims_[1];
+
+    const double v00 = v[0] + t[0] * (v[1] - v[0]);
+    const double v10 = v[sy] + t[0] * (v[sy + 1] - v[sy]);
+    const double v01 = v[sz] + t[0] * (v[sz + 1] - v[sz]);
+    const double v11 = v[sz + sy] + t[0] * (v[sz + sy + 1] - v[sz + sy]);
+
+    const double v0 = v00 + t[1] * (v10 - v00);
+    const double v1 = v01 + t[1] * (v11 - v01);
+    const double d2 = v0 + t[2] * (v1 - v0);
+
+    if (outside2 > 0)
+    {
+      // the nearest point is at most the grid edge value plus the trip there
+      const double d = sqrt(d2) + sqrt(outside2);
+      return d * d;
+    }
+
+    return d2;
+  }
+
+  /**
+   * @brief Spacing and margin the field was requested with
+   */
+  double requestedSpacing() const;
+  double margin() const;
+
+  /**
+   * @brief Distance between samples, may be coarser than requested
+   */
+  double spacing() const;
+
+  /**
+   * @brief Number of samples
+   */
+  size_t samples() const;
+
+private:
+  void buildSlice(size_t k, const KdTree* tree);
+
+  double origin_[3];
+  long dims_[3];
+  double spacing_;
+  double inv_spacing_;
+  double requested_spacing_;
+  double margin_;
+
+  // samples, x fastest: (k * dims_[1] + j) * dims_[0] + i
+  std::vector<float> values_;
+};
+
+#endif // DISTANCEFIELD_H
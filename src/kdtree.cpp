@@ -0,0 +1,378 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      kdtree.cpp
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include "kdtree.h"
+#include "nearestkernel.h"
+#include <algorithm>
+#include <math.h>
+
+// points per leaf, leaves are scanned linearly
+static const size_t LEAF_SIZE = 8;
+
+namespace
+{
+struct AxisLess
+{
+  AxisLess(const std::vector<double>& c) : coord(c) {}
+
+  bool operator()(size_t a, size_t b) const
+  {
+    return coord[a] < coord[b];
+  }
+
+  const std::vector<double>& coord;
+};
+}  // namespace
+
+KdTree::KdTree()
+  : periodic_(false)
+{
+  for (int a = 0; a < 3; a++)
+  {
+    lo_[a] = 0;
+    hi_[a] = 0;
+  }
+}
+
+void KdTree::build(const double* x, const double* y, const double* z, size_t n,
+                   const double lattice[3][3])
+{
+  nodes_.clear();
+  index_.resize(n);
+
+  xyz_[0].assign(x, x + n);
+  xyz_[1].assign(y, y + n);
+  xyz_[2].assign(z, z + n);
+
+  periodic_ = lattice != 0;
+
+  for (int a = 0; a < 3; a++)
+  {
+    shift_[a].clear();
+  }
+
+  if (periodic_)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      for (int a = 0; a < 3; a++)
+      {
+        lattice_[k][a] = lattice[k][a];
+      }
+    }
+
+    // inverse by cofactors, rows of the lattice are the cell vectors
+    const double (*L)[3] = lattice_;
+    const double det =
+        L[0][0] * (L[1][1] * L[2][2] - L[1][2] * L[2][1]) -
+        L[0][1] * (L[1][0] * L[2][2] - L[1][2] * L[2][0]) +
+        L[0][2] * (L[1][0] * L[2][1] - L[1][1] * L[2][0]);
+
+    inverse_[0][0] = (L[1][1] * L[2][2] - L[1][2] * L[2][1]) / det;
+    inverse_[0][1] = (L[0][2] * L[2][1] - L[0][1] * L[2][2]) / det;
+    inverse_[0][2] = (L[0][1] * L[1][2] - L[0][2] * L[1][1]) / det;
+    inverse_[1][0] = (L[1][2] * L[2][0] - L[1][0] * L[2][2]) / det;
+    inverse_[1][1] = (L[0][0] * L[2][2] - L[0][2] * L[2][0]) / det;
+    inverse_[1][2] = (L[0][2] * L[1][0] - L[0][0] * L[1][2]) / det;
+    inverse_[2][0] = (L[1][0] * L[2][1] - L[1][1] * L[2][0]) / det;
+    inverse_[2][1] = (L[0][1] * L[2][0] - L[0][0] * L[2][1]) / det;
+    inverse_[2][2] = (L[0][0] * L[1][1] - L[0][1] * L[1][0]) / det;
+
+    // wrap every point into the cell, remembering how far it moved
+    for (int a = 0; a < 3; a++)
+    {
+      shift_[a].assign(n, 0);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+      const double p[3] = {xyz_[0][i], xyz_[1][i], xyz_[2][i]};
+      double move[3];
+      wrap(p, move);
+
+      for (int a = 0; a < 3; a++)
+      {
+        shift_[a][i] = move[a];
+        xyz_[a][i] += move[a];
+      }
+    }
+  }
+
+  for (size_t i = 0; i < n; i++)
+  {
+    index_[i] = i;
+  }
+
+  if (n)
+  {
+    nodes_.reserve(2 * n / LEAF_SIZE + 1);
+    buildNode(0, n);
+  }
+
+  // store coordinates in tree order so leaves are contiguous
+  for (int a = 0; a < 3; a++)
+  {
+    std::vector<double> sorted(n);
+
+    for (size_t i = 0; i < n; i++)
+    {
+      sorted[i] = xyz_[a][index_[i]];
+    }
+
+    xyz_[a].swap(sorted);
+
+    if (periodic_)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        sorted[i] = shift_[a][index_[i]];
+      }
+
+      shift_[a].swap(sorted);
+    }
+
+    if (n)
+    {
+      lo_[a] = *std::min_element(xyz_[a].begin(), xyz_[a].end());
+      hi_[a] = *std::max_element(xyz_[a].begin(), xyz_[a].end());
+    }
+  }
+}
+
+size_t KdTree::buildNode(size_t begin, size_t end)
+{
+  const size_t id = nodes_.size();
+  nodes_.push_back(Node());
+
+  Node node;
+  node.split = 0;
+  node.axis = -1;
+  node.begin = begin;
+  node.end = end;
+  node.left = 0;
+  node.right = 0;
+
+  if (end - begin > LEAF_SIZE)
+  {
+    // split the axis with the widest spread at the median
+    double spread = -1;
+
+    for (int a = 0; a < 3; a++)
+    {
+      double lo = xyz_[a][index_[begin]];
+      double hi = lo;
+
+      for (size_t i = begin + 1; i < end; i++)
+      {
+        lo = std::min(lo, xyz_[a][index_[i]]);
+        hi = std::max(hi, xyz_[a][index_[i]]);
+      }
+
+      if (hi - lo > spread)
+      {
+        spread = hi - lo;
+        node.axis = a;
+      }
+    }
+
+    const size_t mid = begin + (end - begin) / 2;
+
+    std::nth_element(index_.begin() + begin,
+                     index_.begin() + mid,
+                     index_.begin() + end,
+                     AxisLess(xyz_[node.axis]));
+
+    node.split = xyz_[node.axis][index_[mid]];
+    node.left = buildNode(begin, mid);
+    node.right = buildNode(mid, end);
+  }
+  else
+  {
+    // leaves keep original order so the first minimum of a leaf scan is
+    // also the one with the lowest original index
+    std::sort(index_.begin() + begin, index_.begin() + end);
+  }
+
+  nodes_[id] = node;
+  return id;
+}
+
+bool KdTree::nearest(double px, double py, double pz,
+                     size_t& idx, double& dist2) const
+{
+  double offset[3];
+  return nearest(px, py, pz, idx, dist2, offset);
+}
+
+bool KdTree::nearest(double px, double py, double pz,
+                     size_t& idx, double& dist2, double offset[3]) const
+{
+  if (nodes_.empty())
+  {
+    return false;
+  }
+
+  const double p[3] = {px, py, pz};
+  size_t best = index_.size();
+  double best_dist2 = 0;
+
+  if (periodic_)
+  {
+    double image[3];
+    searchImages(p, best, best_dist2, image);
+
+    // the point was found from image, its nearest image to p is the
+    // wrapped point moved by p - image
+    for (int a = 0; a < 3; a++)
+    {
+      offset[a] = shift_[a][best] + p[a] - image[a];
+    }
+  }
+  else
+  {
+    search(0, p, best, best_dist2);
+
+    for (int a = 0; a < 3; a++)
+    {
+      offset[a] = 0;
+    }
+  }
+
+  idx = index_[best];
+  dist2 = best_dist2;
+  return true;
+}
+
+bool KdTree::periodic() const
+{
+  return periodic_;
+}
+
+size_t KdTree::size() const
+{
+  return index_.size();
+}
+
+void KdTree::search(size_t id, const double p[3],
+                    size_t& best, double& best_dist2) const
+{
+  const Node& node = nodes_[id];
+
+  if (node.axis < 0)
+  {
+    size_t k;
+    double d2;
+
+    NearestKernel::nearest(&xyz_[0][node.begin], &xyz_[1][node.begin],
+                           &xyz_[2][node.begin], node.end - node.begin,
+                           p[0], p[1], p[2], k, d2);
+    k += node.begin;
+
+    // ties go to the lowest original index, matching a linear scan
+    if (best == index_.size() || d2 < best_dist2 ||
+        (d2 == best_dist2 && index_[k] < index_[best]))
+    {
+      best = k;
+      best_dist2 = d2;
+    }
+    return;
+  }
+
+  const double diff = p[node.axis] - node.split;
+  const size_t first = diff < 0 ? node.left : node.right;
+  const size_t second = diff < 0 ? node.right : node.left;
+
+  search(first, p, best, best_dist2);
+
+  // points equal to the split may be on either side, hence <=
+  if (diff * diff <= best_dist2)
+  {
+    search(second, p, best, best_dist2);
+  }
+}
+
+void KdTree::searchImages(const double p[3], size_t& best, double& best_dist2,
+                          double image[3]) const
+{
+  double move[3];
+  wrap(p, move);
+
+  const double home[3] = {p[0] + move[0], p[1] + move[1], p[2] + move[2]};
+
+  // the query's own cell first so the neighbours are mostly pruned
+  static const int steps[3] = {0, -1, 1};
+
+  for (int i = 0; i < 3; i++)
+  {
+    for (int j = 0; j < 3; j++)
+    {
+      for (int k = 0; k < 3; k++)
+      {
+        double q[3];
+        double box2 = 0;
+
+        for (int a = 0; a < 3; a++)
+        {
+          q[a] = home[a] + steps[i] * lattice_[0][a] +
+                 steps[j] * lattice_[1][a] + steps[k] * lattice_[2][a];
+
+          const double out = std::max(lo_[a] - q[a], q[a] - hi_[a]);
+
+          if (out > 0)
+          {
+            box2 += out * out;
+          }
+        }
+
+        // equal distances are still searched, they may hold a lower index
+        if (best < index_.size() && box2 > best_dist2)
+        {
+          continue;
+        }
+
+        const size_t before = best;
+        const double before_dist2 = best_dist2;
+
+        search(0, q, best, best_dist2);
+
+        if (best != before || best_dist2 != before_dist2)
+        {
+          image[0] = q[0];
+          image[1] = q[1];
+          image[2] = q[2];
+        }
+      }
+    }
+  }
+}
+
+void KdTree::wrap(const double p[3], double move[3]) const
+{
+  for (int a = 0; a < 3; a++)
+  {
+    move[a] = 0;
+  }
+
+  for (int k = 0; k < 3; k++)
+  {
+    const double f = p[0] * inverse_[0][k] + p[1] * inverse_[1][k] +
+                     p[2] * inverse_[2][k];
+    const double cells = floor(f);
+
+    for (int a = 0; a < 3; a++)
+    {
+      move[a] -= cells * lattice_[k][a];
+    }
+  }
+}
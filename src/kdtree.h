@@ -0,0 +1,127 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      kdtree.h
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef KDTREE_H
+#define KDTREE_H
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <stddef.h>
+
+/**
+ * 3D k-d tree for nearest neighbour queries. The tree is immutable once
+ * built so a single tree can be queried from several threads.
+ *
+ * A tree built with lattice vectors treats the points as one unit cell of
+ * a periodic crystal and answers queries with the minimum image distance.
+ * Points are wrapped into the cell and the 27 images of the query around
+ * the cell are searched, which finds the minimum image for cells that are
+ * not strongly skewed (for example, reduced cells).
+ */
+class KdTree
+{
+public:
+  typedef boost::shared_ptr<KdTree> Ptr;
+
+  KdTree();
+
+  /**
+   * @brief Build the tree over a set of points
+   * @param x,y,z Coordinate columns, n entries each
+   * @param n Number of points
+   * @param lattice Lattice vectors a, b and c as rows for a periodic tree,
+   *        expected to be linearly independent. Null for open space.
+   */
+  void build(const double* x, const double* y, const double* z, size_t n,
+             const double lattice[3][3] = 0);
+
+  /**
+   * @brief Find the point nearest to p
+   * @param[in] px,py,pz Query point
+   * @param[out] idx Index of the nearest point (index into the build arrays)
+   * @param[out] dist2 Squared distance to the nearest point
+   * @return true if the tree has points
+   */
+  bool nearest(double px, double py, double pz,
+               size_t& idx, double& dist2) const;
+
+  /**
+   * @brief Find the point nearest to p and where its nearest image is
+   * @param[in] px,py,pz Query point
+   * @param[out] idx Index of the nearest point (index into the build arrays)
+   * @param[out] dist2 Squared distance to the nearest image
+   * @param[out] offset Lattice translation from the build position of the
+   *             point to its nearest image, zero for open space
+   * @return true if the tree has points
+   */
+  bool nearest(double px, double py, double pz,
+               size_t& idx, double& dist2, double offset[3]) const;
+
+  /**
+   * @brief True if the tree was built with lattice vectors
+   */
+  bool periodic() const;
+
+  /**
+   * @brief Number of points in the tree
+   */
+  size_t size() const;
+
+private:
+  struct Node
+  {
+    double split;
+    int axis;  // -1 for leaves
+    size_t begin;  // leaf range into the sorted columns
+    size_t end;
+    size_t left;
+    size_t right;
+  };
+
+  size_t buildNode(size_t begin, size_t end);
+
+  void search(size_t node, const double p[3],
+              size_t& best, double& best_dist2) const;
+
+  /**
+   * @brief Minimum image search, image receives the searched query image
+   *        the best point was found from
+   */
+  void searchImages(const double p[3], size_t& best, double& best_dist2,
+                    double image[3]) const;
+
+  /**
+   * @brief Lattice translation moving p into the unit cell
+   */
+  void wrap(const double p[3], double move[3]) const;
+
+  std::vector<Node> nodes_;
+
+  // points in tree order, leaves own contiguous ranges
+  std::vector<size_t> index_;
+  std::vector<double> xyz_[3];
+
+  // bounds of the points, lets image searches skip whole images
+  double lo_[3];
+  double hi_[3];
+
+  bool periodic_;
+  double lattice_[3][3];
+  double inverse_[3][3];  // fractional coordinate k = sum_m p[m] * inverse_[m][k]
+
+  // translation that wrapped each point into the cell, in tree order
+  std::vector<double> shift_[3];
+};
+
+#endif // KDTREE_H
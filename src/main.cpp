@@ -18,7 +18,6 @@
 #include "matrix_interface.h"
 #include "matrix_interface.h"
 #include "interactive.h"
-#include "load_mol2.h"
 #include <stdio.h>
 
 int main(int argc, char** argv)
@@ -32,10 +31,11 @@ int main(int argc, char** argv)
 
   register_interactive(L);
 
-  if (LuaInterface::luaL_dostringn(L, load_mol2, "load_mol2.lua"))
-  {
-    fprintf(stderr, "%s\n", lua_tostring(L, -1));
-  }
+  // scripts written against the old Lua loader call the global loadMol2
+  lua_getglobal(L, "AtomContainer");
+  lua_getfield(L, -1, "loadMol2");
+  lua_setglobal(L, "loadMol2");
+  lua_pop(L, 1);
 
   if (argc > 1)
   {
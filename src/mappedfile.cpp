@@ -0,0 +1,108 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      mappedfile.cpp
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include "mappedfile.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile()
+  : data_(0), size_(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+bool MappedFile::open(const std::string& path)
+{
+  close();
+
+  const int fd = ::open(path.c_str(), O_RDONLY);
+
+  if (fd < 0)
+  {
+    error_ = path + ": " + strerror(errno);
+    return false;
+  }
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0)
+  {
+    error_ = path + ": " + strerror(errno);
+    ::close(fd);
+    return false;
+  }
+
+  size_ = st.st_size;
+
+  // empty files can't be mapped, they are simply empty ranges
+  if (size_)
+  {
+    void* p = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (p == MAP_FAILED)
+    {
+      error_ = path + ": " + strerror(errno);
+      size_ = 0;
+      ::close(fd);
+      return false;
+    }
+
+    // files are read front to back
+    madvise(p, size_, MADV_SEQUENTIAL);
+    data_ = (const char*)p;
+  }
+
+  // the mapping stays valid after the descriptor is closed
+  ::close(fd);
+  return true;
+}
+
+void MappedFile::close()
+{
+  if (data_)
+  {
+    munmap((void*)data_, size_);
+  }
+
+  data_ = 0;
+  size_ = 0;
+}
+
+const char* MappedFile::begin() const
+{
+  return data_;
+}
+
+const char* MappedFile::end() const
+{
+  return data_ + size_;
+}
+
+size_t MappedFile::size() const
+{
+  return size_;
+}
+
+const std::string& MappedFile::error() const
+{
+  return error_;
+}
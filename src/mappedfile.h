@@ -0,0 +1,61 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      mappedfile.h
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <stddef.h>
+
+/**
+ * Read only memory mapping of a whole file
+ */
+class MappedFile
+{
+public:
+  MappedFile();
+  ~MappedFile();
+
+  /**
+   * @brief Map a file, any previous mapping is released
+   * @param path File name
+   * @return true on success, see error() otherwise
+   */
+  bool open(const std::string& path);
+
+  /**
+   * @brief Release the mapping
+   */
+  void close();
+
+  const char* begin() const;
+  const char* end() const;
+  size_t size() const;
+
+  /**
+   * @brief Description of the last failure
+   */
+  const std::string& error() const;
+
+private:
+  // not copyable
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+  const char* data_;
+  size_t size_;
+  std::string error_;
+};
+
+#endif // MAPPEDFILE_H
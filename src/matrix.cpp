@@ -14,12 +14,14 @@
 
 #include "matrix.h"
 #include <dlib/matrix/matrix_math_functions.h>
+#include <algorithm>
 #include <math.h>
 
 namespace Matrix
 {
 
-void makeRotationX(Type& R, double theta)
+template <typename M>
+static void rotationX(M& R, double theta)
 {
   double c, s;
   sincos(theta, &s, &c);
@@ -31,7 +33,8 @@ void makeRotationX(Type& R, double theta)
   R(2, 2) = c;
 }
 
-void makeRotationY(Type& R, double theta)
+template <typename M>
+static void rotationY(M& R, double theta)
 {
   double c, s;
   sincos(theta, &s, &c);
@@ -43,7 +46,8 @@ void makeRotationY(Type& R, double theta)
   R(2, 2) = c;
 }
 
-void makeRotationZ(Type& R, double theta)
+template <typename M>
+static void rotationZ(M& R, double theta)
 {
   double c, s;
   sincos(theta, &s, &c);
@@ -55,6 +59,237 @@ void makeRotationZ(Type& R, double theta)
   R(1, 1) = c;
 }
 
+void makeRotationX(Type& R, double theta)
+{
+  rotationX(R, theta);
+}
+
+void makeRotationY(Type& R, double theta)
+{
+  rotationY(R, theta);
+}
+
+void makeRotationZ(Type& R, double theta)
+{
+  rotationZ(R, theta);
+}
+
+void makeRotationX(Mat3& R, double theta)
+{
+  rotationX(R, theta);
+}
+
+void makeRotationY(Mat3& R, double theta)
+{
+  rotationY(R, theta);
+}
+
+void makeRotationZ(Mat3& R, double theta)
+{
+  rotationZ(R, theta);
+}
+
+void makeRotation(Mat3& R, double rx, double ry, double rz)
+{
+  Mat3 RX, RY, RZ;
+  rotationX(RX, rx);
+  rotationY(RY, ry);
+  rotationZ(RZ, rz);
+
+  R = (RX * RY) * RZ;
+}
+
+void makeRotationDerivatives(Mat3 dR[3], double rx, double ry, double rz)
+{
+  Mat3 RX, RY, RZ;
+  rotationX(RX, rx);
+  rotationY(RY, ry);
+  rotationZ(RZ, rz);
+
+  // the derivative of a plane rotation is the rotation a quarter turn
+  // further with the fixed axis removed
+  Mat3 dRX, dRY, dRZ;
+  rotationX(dRX, rx + M_PI / 2);
+  rotationY(dRY, ry + M_PI / 2);
+  rotationZ(dRZ, rz + M_PI / 2);
+  dRX(0, 0) = 0;
+  dRY(1, 1) = 0;
+  dRZ(2, 2) = 0;
+
+  dR[0] = (dRX * RY) * RZ;
+  dR[1] = (RX * dRY) * RZ;
+  dR[2] = (RX * RY) * dRZ;
+}
+
+void principalAxes(const Mat3& C, Mat3& axes)
+{
+  Mat3 U, V;
+  Vec3 W;
+  dlib::svd3(C, U, W, V);
+
+  // for a symmetric positive semi-definite matrix the singular vectors are
+  // the eigenvectors, they come back unordered
+  long order[3] = {0, 1, 2};
+
+  for (int i = 0; i < 3; i++)
+  {
+    for (int j = i + 1; j < 3; j++)
+    {
+      if (W(order[j]) > W(order[i]))
+      {
+        std::swap(order[i], order[j]);
+      }
+    }
+  }
+
+  for (int c = 0; c < 3; c++)
+  {
+    for (int r = 0; r < 3; r++)
+    {
+      axes(r, c) = U(r, order[c]);
+    }
+  }
+
+  if (dlib::det(axes) < 0)
+  {
+    for (int r = 0; r < 3; r++)
+    {
+      axes(r, 2) = -axes(r, 2);
+    }
+  }
+}
+
+void rotationToAngles(const Mat3& R, double& rx, double& ry, double& rz)
+{
+  // R(0, 2) = -sin(ry) and the first row scales with cos(ry)
+  const double sy = -R(0, 2);
+  const double cy = sqrt(R(0, 0) * R(0, 0) + R(0, 1) * R(0, 1));
+
+  if (cy > 1e-12)
+  {
+    rx = atan2(-R(1, 2), R(2, 2));
+    ry = atan2(sy, cy);
+    rz = atan2(-R(0, 1), R(0, 0));
+  }
+  else
+  {
+    // gimbal lock, rx and rz act on the same axis so rz is folded into rx
+    const double s = sy > 0 ? 1 : -1;
+    rx = atan2(-R(1, 0) * s, R(1, 1));
+    ry = s * M_PI * 0.5;
+    rz = 0;
+  }
+}
+
+void sampleRotations(size_t n, std::vector<Mat3>& R)
+{
+  // Alexa, "Super-Fibonacci Spirals", CVPR 2022
+  const double phi = sqrt(2.0);
+  const double psi = 1.533751168755204288118041;
+
+  R.resize(n);
+
+  for (size_t i = 0; i < n; i++)
+  {
+    const double s = i + 0.5;
+    const double r = sqrt(s / n);
+    const double t = sqrt(1.0 - s / n);
+    const double alpha = 2 * M_PI * s / phi;
+    const double beta = 2 * M_PI * s / psi;
+
+    // unit quaternion (w, x, y, z)
+    const double w = r * sin(alpha);
+    const double x = r * cos(alpha);
+    const double y = t * sin(beta);
+    const double z = t * cos(beta);
+
+    Mat3& M = R[i];
+    M(0, 0) = 1 - 2 * (y * y + z * z);
+    M(0, 1) = 2 * (x * y - w * z);
+    M(0, 2) = 2 * (x * z + w * y);
+    M(1, 0) = 2 * (x * y + w * z);
+    M(1, 1) = 1 - 2 * (x * x + z * z);
+    M(1, 2) = 2 * (y * z - w * x);
+    M(2, 0) = 2 * (x * z - w * y);
+    M(2, 1) = 2 * (y * z + w * x);
+    M(2, 2) = 1 - 2 * (x * x + y * y);
+  }
+}
+
+RigidFit::RigidFit()
+  : n_(0)
+{
+  sp_ = 0;
+  sq_ = 0;
+  spq_ = 0;
+}
+
+void RigidFit::add(double px, double py, double pz,
+                   double qx, double qy, double qz)
+{
+  const double p[3] = {px, py, pz};
+  const double q[3] = {qx, qy, qz};
+
+  for (int i = 0; i < 3; i++)
+  {
+    sp_(i) += p[i];
+    sq_(i) += q[i];
+
+    for (int j = 0; j < 3; j++)
+    {
+      spq_(i, j) += p[i] * q[j];
+    }
+  }
+
+  n_++;
+}
+
+double RigidFit::count() const
+{
+  return n_;
+}
+
+bool RigidFit::solve(Mat3& R, Vec3& d) const
+{
+  if (n_ <= 0)
+  {
+    return false;
+  }
+
+  const Vec3 cp = sp_ / n_;
+  const Vec3 cq = sq_ / n_;
+
+  // cross covariance of the centered pairs
+  const Mat3 H = spq_ - n_ * (cp * dlib::trans(cq));
+
+  Mat3 U, V;
+  Vec3 W;
+  dlib::svd3(H, U, W, V);
+
+  // singular values are unordered, if the fit is a reflection flip the
+  // direction with the smallest singular value
+  Mat3 D = dlib::identity_matrix<double,long>(3);
+
+  if (dlib::det(V * dlib::trans(U)) < 0)
+  {
+    long k = 0;
+
+    for (long i = 1; i < 3; i++)
+    {
+      if (W(i) < W(k))
+      {
+        k = i;
+      }
+    }
+
+    D(k, k) = -1;
+  }
+
+  R = V * D * dlib::trans(U);
+  d = cq - R * cp;
+  return true;
+}
+
 double sumOfSquares(const Type& M)
 {
   return dlib::sum(dlib::pointwise_multiply(M, M));
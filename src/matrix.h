@@ -24,10 +24,87 @@ namespace Matrix
   typedef dlib::matrix<double, 0, 0> Type;
   typedef boost::shared_ptr<Type> Ptr;
 
+  // fixed size types for geometry, these live on the stack
+  typedef dlib::matrix<double, 3, 1> Vec3;
+  typedef dlib::matrix<double, 3, 3> Mat3;
+
   void makeRotationX(Type& R, double theta);
   void makeRotationY(Type& R, double theta);
   void makeRotationZ(Type& R, double theta);
 
+  void makeRotationX(Mat3& R, double theta);
+  void makeRotationY(Mat3& R, double theta);
+  void makeRotationZ(Mat3& R, double theta);
+
+  /**
+   * @brief Build the rotation used by container transforms, R = RX * RY * RZ
+   * @param R destination
+   * @param rx,ry,rz rotation angles
+   */
+  void makeRotation(Mat3& R, double rx, double ry, double rz);
+
+  /**
+   * @brief Partial derivatives of makeRotation with respect to each angle
+   * @param dR destination, dR[0] = dR/drx, dR[1] = dR/dry, dR[2] = dR/drz
+   * @param rx,ry,rz rotation angles
+   */
+  void makeRotationDerivatives(Mat3 dR[3], double rx, double ry, double rz);
+
+  /**
+   * @brief Principal axes of a covariance matrix
+   * @param[in] C symmetric positive semi-definite 3x3 matrix
+   * @param[out] axes unit axes as columns, ordered by decreasing variance
+   *             and forming a right handed frame (a rotation)
+   */
+  void principalAxes(const Mat3& C, Mat3& axes);
+
+  /**
+   * @brief Recover angles from a rotation built by makeRotation
+   * @param R rotation
+   * @param rx,ry,rz angles such that makeRotation(rx, ry, rz) == R
+   */
+  void rotationToAngles(const Mat3& R, double& rx, double& ry, double& rz);
+
+  /**
+   * @brief Build a set of rotations spread evenly over all orientations
+   *        (super-Fibonacci spiral over unit quaternions)
+   * @param n Number of rotations
+   * @param[out] R rotations
+   */
+  void sampleRotations(size_t n, std::vector<Mat3>& R);
+
+  /**
+   * @brief Accumulates point pairs (p, q) and solves for the rigid transform
+   *        minimizing the sum of |R * p + d - q|^2 (Kabsch)
+   */
+  class RigidFit
+  {
+  public:
+    RigidFit();
+
+    void add(double px, double py, double pz,
+             double qx, double qy, double qz);
+
+    /**
+     * @brief Number of pairs added
+     */
+    double count() const;
+
+    /**
+     * @brief Solve for the best rotation and displacement
+     * @param[out] R rotation, a proper rotation (no reflection)
+     * @param[out] d displacement
+     * @return true if any pairs were added
+     */
+    bool solve(Mat3& R, Vec3& d) const;
+
+  private:
+    double n_;
+    Vec3 sp_;
+    Vec3 sq_;
+    Mat3 spq_;
+  };
+
   double sumOfSquares(const Type& M);
 
   /**
@@ -0,0 +1,237 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      mol2.cpp
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include "mol2.h"
+#include "textscan.h"
+#include <map>
+#include <stdio.h>
+
+static const char TAG[] = "@<TRIPOS>";
+static const size_t TAG_LEN = sizeof(TAG) - 1;
+
+enum Section
+{
+  NONE,
+  MOLECULE,
+  ATOM,
+  BOND,
+  OTHER
+};
+
+// true if [p, end) starts with the string s
+static bool startsWith(const char* p, const char* end, const char* s)
+{
+  const size_t n = strlen(s);
+  return (size_t)(end - p) >= n && memcmp(p, s, n) == 0;
+}
+
+Mol2Reader::Mol2Reader()
+  : pos_(0), line_(0)
+{
+}
+
+bool Mol2Reader::open(const std::string& path)
+{
+  path_ = path;
+  line_ = 0;
+  error_.clear();
+
+  if (!file_.open(path))
+  {
+    error_ = file_.error();
+    return false;
+  }
+
+  pos_ = file_.begin();
+  return true;
+}
+
+bool Mol2Reader::next(AtomContainer& ac, std::vector<Bond>& bonds, std::string& name)
+{
+  using namespace TextScan;
+
+  const char* end = file_.end();
+
+  ac.clear();
+  bonds.clear();
+  name.clear();
+  error_.clear();
+
+  Section section = NONE;
+  bool started = false;
+  bool have_name = false;
+
+  // atom ids are normally 1..n in order, a map is only built when they aren't
+  std::vector<long> ids;
+  std::map<long, size_t> rows;
+  bool sequential = true;
+
+  while (pos_ < end)
+  {
+    const char* p = pos_;
+    const char* le = lineEnd(p, end);
+
+    if (startsWith(p, le, TAG))
+    {
+      const char* tag = p + TAG_LEN;
+
+      if (startsWith(tag, le, "MOLECULE"))
+      {
+        if (started)
+        {
+          break;  // start of the next molecule, leave it for the next call
+        }
+        section = MOLECULE;
+      }
+      else if (startsWith(tag, le, "ATOM"))
+      {
+        section = ATOM;
+      }
+      else if (startsWith(tag, le, "BOND"))
+      {
+        section = BOND;
+      }
+      else
+      {
+        section = OTHER;
+      }
+
+      started = true;
+    }
+    else
+    {
+      skipSpace(p, le);
+
+      // blank lines and comments carry nothing
+      if (p < le && *p != '#')
+      {
+        if (section == MOLECULE && !have_name)
+        {
+          const char* ne = le;
+
+          while (ne > p && isSpace(ne[-1]))
+          {
+            ne--;
+          }
+
+          name.assign(p, ne);
+          have_name = true;
+        }
+        else if (section == ATOM)
+        {
+          long id;
+          const char* tok;
+          size_t len;
+          const char* type;
+          size_t type_len;
+          double x, y, z;
+
+          if (!parseLong(p, le, id) ||
+              !token(p, le, tok, len) ||
+              !parseDouble(p, le, x) ||
+              !parseDouble(p, le, y) ||
+              !parseDouble(p, le, z) ||
+              !token(p, le, type, type_len))
+          {
+            return fail("expected `id name x y z type'");
+          }
+
+          // element part of the SYBYL type
+          const char* dot = (const char*)memchr(type, '.', type_len);
+
+          if (dot && dot > type)
+          {
+            type_len = dot - type;
+          }
+
+          if (sequential && id != (long)ids.size() + 1)
+          {
+            sequential = false;
+
+            for (size_t i = 0; i < ids.size(); i++)
+            {
+              rows[ids[i]] = i;
+            }
+          }
+
+          if (!sequential)
+          {
+            rows[id] = ac.size();
+          }
+
+          ids.push_back(id);
+          ac.add(std::string(type, type_len), std::string(tok, len), x, y, z);
+        }
+        else if (section == BOND)
+        {
+          long id, a1, a2;
+
+          if (!parseLong(p, le, id) ||
+              !parseLong(p, le, a1) ||
+              !parseLong(p, le, a2))
+          {
+            return fail("expected `id atom1 atom2'");
+          }
+
+          Bond bond;
+
+          if (sequential)
+          {
+            if (a1 < 1 || a2 < 1 || a1 > (long)ids.size() || a2 > (long)ids.size())
+            {
+              return fail("bond references unknown atom");
+            }
+
+            bond.a = a1 - 1;
+            bond.b = a2 - 1;
+          }
+          else
+          {
+            std::map<long, size_t>::const_iterator i1 = rows.find(a1);
+            std::map<long, size_t>::const_iterator i2 = rows.find(a2);
+
+            if (i1 == rows.end() || i2 == rows.end())
+            {
+              return fail("bond references unknown atom");
+            }
+
+            bond.a = i1->second;
+            bond.b = i2->second;
+          }
+
+          bonds.push_back(bond);
+        }
+      }
+    }
+
+    line_++;
+    nextLine(pos_, end);
+  }
+
+  return started;
+}
+
+const std::string& Mol2Reader::error() const
+{
+  return error_;
+}
+
+bool Mol2Reader::fail(const std::string& msg)
+{
+  char where[64];
+  snprintf(where, sizeof(where), ":%lu: ", (unsigned long)(line_ + 1));
+  error_ = path_ + where + msg;
+  pos_ = file_.end();
+  return false;
+}
@@ -0,0 +1,74 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      mol2.h
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef MOL2_H
+#define MOL2_H
+
+#include "atomcontainer.h"
+#include "mappedfile.h"
+#include <string>
+#include <vector>
+
+/**
+ * Reads TRIPOS mol2 files one molecule at a time. Only the MOLECULE name,
+ * ATOM and BOND sections are used.
+ */
+class Mol2Reader
+{
+public:
+  /**
+   * @brief Bond between two rows of the molecule's container
+   */
+  struct Bond
+  {
+    size_t a;
+    size_t b;
+  };
+
+  Mol2Reader();
+
+  /**
+   * @brief Open a file for reading
+   * @param path File name
+   * @return true on success, see error() otherwise
+   */
+  bool open(const std::string& path);
+
+  /**
+   * @brief Read the next molecule. Atom types are the element part of the
+   *        SYBYL type (C.ar becomes C).
+   * @param[out] ac Container to fill, it is cleared first
+   * @param[out] bonds Bonds of the molecule, cleared first
+   * @param[out] name Molecule name, empty if the file has no MOLECULE section
+   * @return false at the end of the file or on a parse error, error() is
+   *         empty in the first case
+   */
+  bool next(AtomContainer& ac, std::vector<Bond>& bonds, std::string& name);
+
+  /**
+   * @brief Description of the last failure
+   */
+  const std::string& error() const;
+
+private:
+  bool fail(const std::string& msg);
+
+  MappedFile file_;
+  std::string path_;
+  const char* pos_;
+  size_t line_;
+  std::string error_;
+};
+
+#endif // MOL2_H
@@ -0,0 +1,278 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      nearestkernel.cpp
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include "nearestkernel.h"
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NEARESTKERNEL_X86
+#include <immintrin.h>
+#endif
+
+// Every version computes ex * ex + ey * ey + ez * ez in that order without
+// fused multiply-adds so they all return the same distances, bit for bit.
+// The compiler must not fuse them either (AVX-512 targets have FMA), so this
+// file is built with -ffp-contract=off, see CMakeLists.txt.
+// Each vector lane keeps its own best value and position, lanes only take
+// strictly smaller values so every lane holds its first minimum. The lanes
+// are merged at the end preferring the lowest position on ties.
+
+typedef void (*KernelFn)(const double*, const double*, const double*, size_t,
+                         double, double, double, size_t&, double&);
+
+// scalar scan of [begin, n), only replaces the best on strictly smaller values
+static inline void scanTail(const double* x, const double* y, const double* z,
+                            size_t begin, size_t n,
+                            double px, double py, double pz,
+                            size_t& best, double& best_dist2)
+{
+  for (size_t k = begin; k < n; k++)
+  {
+    const double ex = px - x[k];
+    const double ey = py - y[k];
+    const double ez = pz - z[k];
+    const double d2 = ex * ex + ey * ey + ez * ez;
+
+    if (d2 < best_dist2)
+    {
+      best = k;
+      best_dist2 = d2;
+    }
+  }
+}
+
+// fold per-lane results into best, lanes hold positions as doubles
+static inline void mergeLanes(const double* value, const double* position, int lanes,
+                              size_t& best, double& best_dist2)
+{
+  for (int l = 0; l < lanes; l++)
+  {
+    const size_t k = (size_t)position[l];
+
+    if (value[l] < best_dist2 || (value[l] == best_dist2 && k < best))
+    {
+      best = k;
+      best_dist2 = value[l];
+    }
+  }
+}
+
+static void nearestScalar(const double* x, const double* y, const double* z, size_t n,
+                          double px, double py, double pz,
+                          size_t& idx, double& dist2)
+{
+  idx = n;
+  dist2 = HUGE_VAL;
+  scanTail(x, y, z, 0, n, px, py, pz, idx, dist2);
+}
+
+#ifdef NEARESTKERNEL_X86
+__attribute__((target("sse2")))
+static void nearestSSE2(const double* x, const double* y, const double* z, size_t n,
+                        double px, double py, double pz,
+                        size_t& idx, double& dist2)
+{
+  const __m128d qx = _mm_set1_pd(px);
+  const __m128d qy = _mm_set1_pd(py);
+  const __m128d qz = _mm_set1_pd(pz);
+  const __m128d step = _mm_set1_pd(2);
+
+  __m128d best = _mm_set1_pd(HUGE_VAL);
+  __m128d best_pos = _mm_set1_pd((double)n);
+  __m128d pos = _mm_set_pd(1, 0);
+
+  const size_t end = n & ~(size_t)1;
+
+  for (size_t k = 0; k < end; k += 2)
+  {
+    const __m128d ex = _mm_sub_pd(qx, _mm_loadu_pd(x + k));
+    const __m128d ey = _mm_sub_pd(qy, _mm_loadu_pd(y + k));
+    const __m128d ez = _mm_sub_pd(qz, _mm_loadu_pd(z + k));
+    const __m128d d2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ex, ex), _mm_mul_pd(ey, ey)),
+                                  _mm_mul_pd(ez, ez));
+
+    // no blend before SSE4.1, select with and/andnot/or
+    const __m128d less = _mm_cmplt_pd(d2, best);
+    best = _mm_or_pd(_mm_and_pd(less, d2), _mm_andnot_pd(less, best));
+    best_pos = _mm_or_pd(_mm_and_pd(less, pos), _mm_andnot_pd(less, best_pos));
+    pos = _mm_add_pd(pos, step);
+  }
+
+  double value[2];
+  double position[2];
+  _mm_storeu_pd(value, best);
+  _mm_storeu_pd(position, best_pos);
+
+  idx = n;
+  dist2 = HUGE_VAL;
+  mergeLanes(value, position, 2, idx, dist2);
+  scanTail(x, y, z, end, n, px, py, pz, idx, dist2);
+}
+
+__attribute__((target("avx2")))
+static void nearestAVX2(const double* x, const double* y, const double* z, size_t n,
+                        double px, double py, double pz,
+                        size_t& idx, double& dist2)
+{
+  const __m256d qx = _mm256_set1_pd(px);
+  const __m256d qy = _mm256_set1_pd(py);
+  const __m256d qz = _mm256_set1_pd(pz);
+  const __m256d step = _mm256_set1_pd(4);
+
+  __m256d best = _mm256_set1_pd(HUGE_VAL);
+  __m256d best_pos = _mm256_set1_pd((double)n);
+  __m256d pos = _mm256_set_pd(3, 2, 1, 0);
+
+  const size_t end = n & ~(size_t)3;
+
+  for (size_t k = 0; k < end; k += 4)
+  {
+    const __m256d ex = _mm256_sub_pd(qx, _mm256_loadu_pd(x + k));
+    const __m256d ey = _mm256_sub_pd(qy, _mm256_loadu_pd(y + k));
+    const __m256d ez = _mm256_sub_pd(qz, _mm256_loadu_pd(z + k));
+    const __m256d d2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ex, ex),
+                                                   _mm256_mul_pd(ey, ey)),
+                                     _mm256_mul_pd(ez, ez));
+
+    const __m256d less = _mm256_cmp_pd(d2, best, _CMP_LT_OQ);
+    best = _mm256_blendv_pd(best, d2, less);
+    best_pos = _mm256_blendv_pd(best_pos, pos, less);
+    pos = _mm256_add_pd(pos, step);
+  }
+
+  double value[4];
+  double position[4];
+  _mm256_storeu_pd(value, best);
+  _mm256_storeu_pd(position, best_pos);
+
+  idx = n;
+  dist2 = HUGE_VAL;
+  mergeLanes(value, position, 4, idx, dist2);
+  scanTail(x, y, z, end, n, px, py, pz, idx, dist2);
+}
+
+__attribute__((target("avx512f")))
+static void nearestAVX512(const double* x, const double* y, const double* z, size_t n,
+                          double px, double py, double pz,
+                          size_t& idx, double& dist2)
+{
+  const __m512d qx = _mm512_set1_pd(px);
+  const __m512d qy = _mm512_set1_pd(py);
+  const __m512d qz = _mm512_set1_pd(pz);
+  const __m512d step = _mm512_set1_pd(8);
+
+  __m512d best = _mm512_set1_pd(HUGE_VAL);
+  __m512d best_pos = _mm512_set1_pd((double)n);
+  __m512d pos = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0);
+
+  const size_t end = n & ~(size_t)7;
+
+  for (size_t k = 0; k < end; k += 8)
+  {
+    const __m512d ex = _mm512_sub_pd(qx, _mm512_loadu_pd(x + k));
+    const __m512d ey = _mm512_sub_pd(qy, _mm512_loadu_pd(y + k));
+    const __m512d ez = _mm512_sub_pd(qz, _mm512_loadu_pd(z + k));
+    const __m512d d2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ex, ex),
+                                                   _mm512_mul_pd(ey, ey)),
+                                     _mm512_mul_pd(ez, ez));
+
+    const __mmask8 less = _mm512_cmp_pd_mask(d2, best, _CMP_LT_OQ);
+    best = _mm512_mask_blend_pd(less, best, d2);
+    best_pos = _mm512_mask_blend_pd(less, best_pos, pos);
+    pos = _mm512_add_pd(pos, step);
+  }
+
+  double value[8];
+  double position[8];
+  _mm512_storeu_pd(value, best);
+  _mm512_storeu_pd(position, best_pos);
+
+  idx = n;
+  dist2 = HUGE_VAL;
+  mergeLanes(value, position, 8, idx, dist2);
+  scanTail(x, y, z, end, n, px, py, pz, idx, dist2);
+}
+#endif
+
+namespace
+{
+struct Dispatch
+{
+  Dispatch() : fn(nearestScalar), name("scalar")
+  {
+#ifdef NEARESTKERNEL_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f"))
+    {
+      fn = nearestAVX512;
+      name = "avx512";
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+      fn = nearestAVX2;
+      name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+      fn = nearestSSE2;
+      name = "sse2";
+    }
+#endif
+  }
+
+  KernelFn fn;
+  const char* name;
+};
+
+// resolved once, on first use
+const Dispatch& dispatch()
+{
+  static const Dispatch d;
+  return d;
+}
+}  // namespace
+
+bool NearestKernel::nearest(const double* x, const double* y, const double* z, size_t n,
+                            double px, double py, double pz,
+                            size_t& idx, double& dist2)
+{
+  if (n == 0)
+  {
+    return false;
+  }
+
+  size_t best;
+  double best_dist2;
+  dispatch().fn(x, y, z, n, px, py, pz, best, best_dist2);
+
+  // every distance was NaN or infinite, report the first point like a scan would
+  if (best == n)
+  {
+    const double ex = px - x[0];
+    const double ey = py - y[0];
+    const double ez = pz - z[0];
+    best = 0;
+    best_dist2 = ex * ex + ey * ey + ez * ez;
+  }
+
+  idx = best;
+  dist2 = best_dist2;
+  return true;
+}
+
+const char* NearestKernel::variant()
+{
+  return dispatch().name;
+}
@@ -0,0 +1,44 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      nearestkernel.h
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef NEARESTKERNEL_H
+#define NEARESTKERNEL_H
+
+#include <stddef.h>
+
+// Squared distance and argmin over packed coordinate columns. This is the
+// innermost loop of every nearest neighbour query (k-d tree leaves, cell list
+// cells) so it has SSE2, AVX2 and AVX-512 versions, picked once at run time
+// from what the CPU supports, and a portable scalar fallback.
+namespace NearestKernel
+{
+  /**
+   * @brief Find the point of x,y,z nearest to p
+   * @param[in] x,y,z Coordinate columns, n entries each
+   * @param[in] n Number of points
+   * @param[in] px,py,pz Query point
+   * @param[out] idx Position of the nearest point, the first one on ties
+   * @param[out] dist2 Squared distance to the nearest point
+   * @return false if n is 0, outputs are untouched
+   */
+  bool nearest(const double* x, const double* y, const double* z, size_t n,
+               double px, double py, double pz, size_t& idx, double& dist2);
+
+  /**
+   * @brief Name of the version in use: "avx512", "avx2", "sse2" or "scalar"
+   */
+  const char* variant();
+}
+
+#endif // NEARESTKERNEL_H
@@ -0,0 +1,189 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      screen.cpp
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include "screen.h"
+#include "threadpool.h"
+#include <algorithm>
+
+struct Screen::Task
+{
+  void operator()(size_t k) const
+  {
+    Hit& hit = (*hits)[k];
+    hit.index = k;
+    screen->screenOne((*candidates)[k], *fixed_starts, *rotations,
+                      method, rho_begin, rho_end, steps, hit);
+  }
+
+  const Screen* screen;
+  const std::vector<AtomContainer::Ptr>* candidates;
+  const std::vector<Alignment::Params>* fixed_starts;
+  const std::vector<Matrix::Mat3>* rotations;
+  AtomContainer::AlignMethod method;
+  double rho_begin;
+  double rho_end;
+  int steps;
+  std::vector<Hit>* hits;
+};
+
+static bool hitLess(const Screen::Hit& a, const Screen::Hit& b)
+{
+  return a.diff < b.diff;
+}
+
+static Alignment::Params toParams(const Matrix::Mat3& R, const Matrix::Vec3& d)
+{
+  Alignment::Params X(6);
+  X(0) = d(0);
+  X(1) = d(1);
+  X(2) = d(2);
+  Matrix::rotationToAngles(R, X(3), X(4), X(5));
+  return X;
+}
+
+Screen::Screen(AtomContainer::Ptr reference)
+  : reference_(reference), field_(0), field_margin_(0)
+{
+  reference_->kdTree();
+  spread(*reference_, centroid_, axes_);
+}
+
+void Screen::useDistanceField(double spacing, double margin)
+{
+  field_ = spacing;
+  field_margin_ = margin;
+
+  if (field_ > 0)
+  {
+    reference_->distanceField(field_, field_margin_);
+  }
+}
+
+void Screen::run(const std::vector<AtomContainer::Ptr>& candidates,
+                 const Alignment::Params& X0, size_t starts,
+                 AtomContainer::AlignMethod method,
+                 double rho_begin, double rho_end, int steps,
+                 std::vector<Hit>& hits) const
+{
+  const std::vector<Alignment::Params> fixed_starts(1, X0);
+
+  std::vector<Matrix::Mat3> rotations;
+  Matrix::sampleRotations(starts, rotations);
+
+  std::vector<Hit> all(candidates.size());
+
+  Task task;
+  task.screen = this;
+  task.candidates = &candidates;
+  task.fixed_starts = &fixed_starts;
+  task.rotations = &rotations;
+  task.method = method;
+  task.rho_begin = rho_begin;
+  task.rho_end = rho_end;
+  task.steps = steps;
+  task.hits = &all;
+
+  ThreadPool::shared().parallelFor(candidates.size(), task);
+
+  hits.clear();
+
+  for (size_t i = 0; i < all.size(); i++)
+  {
+    if (all[i].X.size())
+    {
+      hits.push_back(all[i]);
+    }
+  }
+
+  // stable sort keeps ties in list order so results don't depend on timing
+  std::stable_sort(hits.begin(), hits.end(), hitLess);
+}
+
+void Screen::screenOne(const AtomContainer::Ptr& candidate,
+                       const std::vector<Alignment::Params>& fixed_starts,
+                       const std::vector<Matrix::Mat3>& rotations,
+                       AtomContainer::AlignMethod method,
+                       double rho_begin, double rho_end, int steps,
+                       Hit& hit) const
+{
+  if (!candidate || candidate->empty())
+  {
+    return;
+  }
+
+  Alignment session(candidate, reference_);
+  // the reference field is shared by every candidate, sampling a field
+  // per candidate would cost more than the searches it replaces
+  session.useReferenceField(field_, field_margin_);
+
+  Matrix::Vec3 c;
+  Matrix::Mat3 axes;
+  spread(*candidate, c, axes);
+
+  std::vector<Alignment::Params> seeds(fixed_starts);
+
+  // principal axes only fix each axis up to its sign, try the four sign
+  // choices that keep the frame right handed
+  static const double signs[4][3] = {{1, 1, 1}, {1, -1, -1}, {-1, 1, -1}, {-1, -1, 1}};
+
+  for (int s = 0; s < 4; s++)
+  {
+    Matrix::Mat3 S = dlib::zeros_matrix<double, 3, 3>();
+    S(0, 0) = signs[s][0];
+    S(1, 1) = signs[s][1];
+    S(2, 2) = signs[s][2];
+
+    const Matrix::Mat3 R = axes_ * S * dlib::trans(axes);
+    seeds.push_back(toParams(R, centroid_ - R * c));
+  }
+
+  for (size_t i = 0; i < rotations.size(); i++)
+  {
+    seeds.push_back(toParams(rotations[i], centroid_ - rotations[i] * c));
+  }
+
+  for (size_t i = 0; i < seeds.size(); i++)
+  {
+    Alignment::Params X = seeds[i];
+    const double diff = session.minimize(X, method, rho_begin, rho_end, steps);
+
+    if (i == 0 || diff < hit.diff)
+    {
+      hit.X = X;
+      hit.diff = diff;
+    }
+  }
+}
+
+void Screen::spread(const AtomContainer& ac, Matrix::Vec3& c, Matrix::Mat3& axes)
+{
+  c = ac.centroid();
+
+  Matrix::Mat3 C = dlib::zeros_matrix<double, 3, 3>();
+
+  for (size_t i = 0; i < ac.size(); i++)
+  {
+    const double p[3] = {ac.x()[i] - c(0), ac.y()[i] - c(1), ac.z()[i] - c(2)};
+
+    for (int u = 0; u < 3; u++)
+    {
+      for (int v = 0; v < 3; v++)
+      {
+        C(u, v) += p[u] * p[v];
+      }
+    }
+  }
+
+  Matrix::principalAxes(C, axes);
+}
@@ -0,0 +1,102 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      screen.h
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <boost/shared_ptr.hpp>
+#include "alignment.h"
+#include "atomcontainer.h"
+#include "matrix.h"
+#include <vector>
+
+/**
+ * Aligns many candidate containers onto one fixed reference. Everything
+ * that only depends on the reference (nearest neighbour index, optional
+ * distance field, centroid and principal axes) is prepared once when the
+ * screen is created and shared by every candidate.
+ *
+ * Each candidate is started from the supplied transform, from the four
+ * proper rotations matching its principal axes to the reference axes and
+ * from any extra evenly spread rotations, and keeps its best local
+ * alignment. Candidates run in parallel on the shared thread pool.
+ */
+class Screen
+{
+public:
+  typedef boost::shared_ptr<Screen> Ptr;
+
+  /**
+   * @brief Outcome for one candidate
+   */
+  struct Hit
+  {
+    size_t index;  // position of the candidate in the screened list
+    Alignment::Params X;
+    double diff;
+  };
+
+  /**
+   * @brief Prepare a reference
+   * @param reference Container candidates are aligned onto, it must not be
+   *        modified while the screen is in use
+   */
+  explicit Screen(AtomContainer::Ptr reference);
+
+  /**
+   * @brief Use the reference's sampled distance field for the objective,
+   *        see Alignment::useReferenceField. The field is built here, once.
+   *        Candidates get no field, distances from the reference to a
+   *        candidate are exact searches in the candidate's k-d tree, which
+   *        the alignment builds anyway.
+   */
+  void useDistanceField(double spacing, double margin);
+
+  /**
+   * @brief Align every candidate onto the reference
+   * @param[in] candidates Containers to screen
+   * @param[in] X0 starting transform tried for every candidate
+   * @param[in] starts extra evenly spread starting rotations per candidate
+   * @param[in] method,rho_begin,rho_end,steps local alignment settings
+   * @param[out] hits one entry per non-empty candidate, best first
+   */
+  void run(const std::vector<AtomContainer::Ptr>& candidates,
+           const Alignment::Params& X0, size_t starts,
+           AtomContainer::AlignMethod method,
+           double rho_begin, double rho_end, int steps,
+           std::vector<Hit>& hits) const;
+
+private:
+  struct Task;
+
+  /**
+   * @brief Screen a single candidate
+   */
+  void screenOne(const AtomContainer::Ptr& candidate,
+                 const std::vector<Alignment::Params>& fixed_starts,
+                 const std::vector<Matrix::Mat3>& rotations,
+                 AtomContainer::AlignMethod method,
+                 double rho_begin, double rho_end, int steps,
+                 Hit& hit) const;
+
+  static void spread(const AtomContainer& ac, Matrix::Vec3& c, Matrix::Mat3& axes);
+
+  AtomContainer::Ptr reference_;
+  Matrix::Vec3 centroid_;
+  Matrix::Mat3 axes_;
+  double field_;
+  double field_margin_;
+};
+
+#endif // SCREEN_H
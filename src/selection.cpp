@@ -0,0 +1,653 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      selection.cpp
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include "selection.h"
+#include <algorithm>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+
+typedef std::map<std::string, AtomContainer::Ptr> Bindings;
+
+/**
+ * Nodes only test rows flagged in active and clear every other row of out,
+ * so "and" and "or" skip rows already decided by their left operand.
+ */
+class Selection::Node
+{
+public:
+  virtual ~Node() {}
+
+  virtual void eval(const AtomContainer& ac, const Bindings& bound,
+                    const std::vector<char>& active,
+                    std::vector<char>& out) const = 0;
+};
+
+namespace
+{
+class ConstNode : public Selection::Node
+{
+public:
+  ConstNode(bool value) : value_(value) {}
+
+  void eval(const AtomContainer& , const Bindings& ,
+            const std::vector<char>& active, std::vector<char>& out) const
+  {
+    for (size_t i = 0; i < active.size(); i++)
+    {
+      out[i] = active[i] && value_;
+    }
+  }
+
+private:
+  bool value_;
+};
+
+class NotNode : public Selection::Node
+{
+public:
+  NotNode(Selection::NodePtr child) : child_(child) {}
+
+  void eval(const AtomContainer& ac, const Bindings& bound,
+            const std::vector<char>& active, std::vector<char>& out) const
+  {
+    child_->eval(ac, bound, active, out);
+
+    for (size_t i = 0; i < active.size(); i++)
+    {
+      out[i] = active[i] && !out[i];
+    }
+  }
+
+private:
+  Selection::NodePtr child_;
+};
+
+class AndNode : public Selection::Node
+{
+public:
+  AndNode(Selection::NodePtr a, Selection::NodePtr b) : a_(a), b_(b) {}
+
+  void eval(const AtomContainer& ac, const Bindings& bound,
+            const std::vector<char>& active, std::vector<char>& out) const
+  {
+    std::vector<char> left(active.size());
+    a_->eval(ac, bound, active, left);
+    b_->eval(ac, bound, left, out);
+  }
+
+private:
+  Selection::NodePtr a_;
+  Selection::NodePtr b_;
+};
+
+class OrNode : public Selection::Node
+{
+public:
+  OrNode(Selection::NodePtr a, Selection::NodePtr b) : a_(a), b_(b) {}
+
+  void eval(const AtomContainer& ac, const Bindings& bound,
+            const std::vector<char>& active, std::vector<char>& out) const
+  {
+    std::vector<char> left(active.size());
+    a_->eval(ac, bound, active, left);
+
+    // only rows the left side rejected are left to test
+    std::vector<char> rest(active.size());
+
+    for (size_t i = 0; i < active.size(); i++)
+    {
+      rest[i] = active[i] && !left[i];
+    }
+
+    b_->eval(ac, bound, rest, out);
+
+    for (size_t i = 0; i < active.size(); i++)
+    {
+      out[i] = out[i] || left[i];
+    }
+  }
+
+private:
+  Selection::NodePtr a_;
+  Selection::NodePtr b_;
+};
+
+class TypeNode : public Selection::Node
+{
+public:
+  TypeNode(const std::vector<std::string>& types) : types_(types) {}
+
+  void eval(const AtomContainer& ac, const Bindings& ,
+            const std::vector<char>& active, std::vector<char>& out) const
+  {
+    const std::vector<std::string>& types = ac.types();
+
+    for (size_t i = 0; i < active.size(); i++)
+    {
+      out[i] = active[i] &&
+               std::find(types_.begin(), types_.end(), types[i]) != types_.end();
+    }
+  }
+
+private:
+  std::vector<std::string> types_;
+};
+
+class NameNode : public Selection::Node
+{
+public:
+  NameNode(const std::vector<std::string>& patterns) : patterns_(patterns) {}
+
+  void eval(const AtomContainer& ac, const Bindings& ,
+            const std::vector<char>& active, std::vector<char>& out) const
+  {
+    const std::vector<std::string>& names = ac.names();
+
+    for (size_t i = 0; i < active.size(); i++)
+    {
+      out[i] = 0;
+
+      for (size_t k = 0; active[i] && !out[i] && k < patterns_.size(); k++)
+      {
+        out[i] = fnmatch(patterns_[k].c_str(), names[i].c_str(), 0) == 0;
+      }
+    }
+  }
+
+private:
+  std::vector<std::string> patterns_;
+};
+
+class CompareNode : public Selection::Node
+{
+public:
+  enum Op {LT, LE, GT, GE, EQ, NE};
+
+  CompareNode(int axis, Op op, double value)
+    : axis_(axis), op_(op), value_(value)
+  {
+  }
+
+  void eval(const AtomContainer& ac, const Bindings& ,
+            const std::vector<char>& active, std::vector<char>& out) const
+  {
+    const std::vector<double>& c =
+        axis_ == 0 ? ac.x() : (axis_ == 1 ? ac.y() : ac.z());
+
+    for (size_t i = 0; i < active.size(); i++)
+    {
+      out[i] = active[i] && test(c[i]);
+    }
+  }
+
+private:
+  bool test(double v) const
+  {
+    switch (op_)
+    {
+    case LT: return v < value_;
+    case LE: return v <= value_;
+    case GT: return v > value_;
+    case GE: return v >= value_;
+    case EQ: return v == value_;
+    case NE: return v != value_;
+    }
+    return false;
+  }
+
+  int axis_;
+  Op op_;
+  double value_;
+};
+
+class WithinNode : public Selection::Node
+{
+public:
+  WithinNode(double radius, const std::string& ref)
+    : radius_(radius), ref_(ref)
+  {
+  }
+
+  void eval(const AtomContainer& ac, const Bindings& bound,
+            const std::vector<char>& active, std::vector<char>& out) const
+  {
+    std::fill(out.begin(), out.end(), 0);
+
+    Bindings::const_iterator it = bound.find(ref_);
+
+    if (it == bound.end() || !it->second)
+    {
+      return;
+    }
+
+    KdTree::Ptr tree = it->second->kdTree();
+    const double r2 = radius_ * radius_;
+
+    for (size_t i = 0; i < active.size(); i++)
+    {
+      size_t j;
+      double d2;
+
+      if (active[i] && tree->nearest(ac.x()[i], ac.y()[i], ac.z()[i], j, d2))
+      {
+        out[i] = d2 <= r2;
+      }
+    }
+  }
+
+private:
+  double radius_;
+  std::string ref_;
+};
+
+bool isKeyword(const std::string& t)
+{
+  static const char* keywords[] = {"and", "or", "not", "all", "none", "type",
+                                   "name", "within", "of", "x", "y", "z", 0};
+
+  for (int i = 0; keywords[i]; i++)
+  {
+    if (t == keywords[i])
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool isOperator(const std::string& t)
+{
+  return t == "(" || t == ")" || t == "<" || t == "<=" || t == ">" ||
+         t == ">=" || t == "==" || t == "!=";
+}
+
+// split an expression into words, parentheses and comparison operators
+void tokenize(const std::string& expr, std::vector<std::string>& tokens)
+{
+  size_t i = 0;
+
+  while (i < expr.size())
+  {
+    const char c = expr[i];
+
+    if (isspace((unsigned char)c))
+    {
+      i++;
+    }
+    else if (c == '(' || c == ')')
+    {
+      tokens.push_back(std::string(1, c));
+      i++;
+    }
+    else if (c == '<' || c == '>' || c == '=' || c == '!')
+    {
+      const size_t len = (i + 1 < expr.size() && expr[i + 1] == '=') ? 2 : 1;
+      tokens.push_back(expr.substr(i, len));
+      i += len;
+    }
+    else
+    {
+      const size_t begin = i;
+
+      while (i < expr.size() && !isspace((unsigned char)expr[i]) &&
+             expr[i] != '(' && expr[i] != ')' && expr[i] != '<' &&
+             expr[i] != '>' && expr[i] != '=' && expr[i] != '!')
+      {
+        i++;
+      }
+
+      tokens.push_back(expr.substr(begin, i - begin));
+    }
+  }
+}
+
+// recursive descent over the token list
+class Parser
+{
+public:
+  Parser(const std::vector<std::string>& tokens,
+         std::vector<std::string>& references)
+    : tokens_(tokens), pos_(0), depth_(0), references_(references)
+  {
+  }
+
+  Selection::NodePtr parse()
+  {
+    Selection::NodePtr node = expr();
+
+    if (node && pos_ < tokens_.size())
+    {
+      return fail("unexpected '" + tokens_[pos_] + "'");
+    }
+
+    return node;
+  }
+
+  const std::string& error() const
+  {
+    return error_;
+  }
+
+private:
+  Selection::NodePtr expr()
+  {
+    Selection::NodePtr node = term();
+
+    while (node && accept("or"))
+    {
+      Selection::NodePtr rhs = term();
+
+      if (!rhs)
+      {
+        return rhs;
+      }
+
+      node.reset(new OrNode(node, rhs));
+    }
+
+    return node;
+  }
+
+  Selection::NodePtr term()
+  {
+    Selection::NodePtr node = factor();
+
+    while (node && accept("and"))
+    {
+      Selection::NodePtr rhs = factor();
+
+      if (!rhs)
+      {
+        return rhs;
+      }
+
+      node.reset(new AndNode(node, rhs));
+    }
+
+    return node;
+  }
+
+  // 'not' and parentheses recurse, the depth is bounded so a hostile
+  // expression can't overflow the stack here or when the tree is evaluated
+  Selection::NodePtr factor()
+  {
+    if (depth_ >= MAX_DEPTH)
+    {
+      return fail("expression nested too deeply");
+    }
+
+    depth_++;
+    Selection::NodePtr node = unary();
+    depth_--;
+    return node;
+  }
+
+  Selection::NodePtr unary()
+  {
+    if (accept("not"))
+    {
+      Selection::NodePtr child = factor();
+      return child ? Selection::NodePtr(new NotNode(child)) : child;
+    }
+
+    if (accept("("))
+    {
+      Selection::NodePtr node = expr();
+
+      if (node && !accept(")"))
+      {
+        return fail("expected ')'");
+      }
+
+      return node;
+    }
+
+    return clause();
+  }
+
+  Selection::NodePtr clause()
+  {
+    if (pos_ >= tokens_.size())
+    {
+      return fail("unexpected end of expression");
+    }
+
+    if (accept("all"))
+    {
+      return Selection::NodePtr(new ConstNode(true));
+    }
+
+    if (accept("none"))
+    {
+      return Selection::NodePtr(new ConstNode(false));
+    }
+
+    if (accept("type") || accept("name"))
+    {
+      const bool is_type = tokens_[pos_ - 1] == "type";
+      std::vector<std::string> words;
+
+      if (!isWord(pos_))
+      {
+        return fail("expected a word after '" + tokens_[pos_ - 1] + "'");
+      }
+
+      words.push_back(tokens_[pos_++]);
+
+      // "type C N" and "type C or N" both list alternatives
+      while (true)
+      {
+        if (isWord(pos_))
+        {
+          words.push_back(tokens_[pos_++]);
+        }
+        else if (pos_ + 1 < tokens_.size() && tokens_[pos_] == "or" &&
+                 isWord(pos_ + 1))
+        {
+          words.push_back(tokens_[pos_ + 1]);
+          pos_ += 2;
+        }
+        else
+        {
+          break;
+        }
+      }
+
+      if (is_type)
+      {
+        return Selection::NodePtr(new TypeNode(words));
+      }
+      return Selection::NodePtr(new NameNode(words));
+    }
+
+    if (tokens_[pos_] == "x" || tokens_[pos_] == "y" || tokens_[pos_] == "z")
+    {
+      const int axis = tokens_[pos_++][0] - 'x';
+      CompareNode::Op op;
+      double value;
+
+      if (pos_ >= tokens_.size() || !comparison(tokens_[pos_], op))
+      {
+        return fail("expected a comparison after '" + tokens_[pos_ - 1] + "'");
+      }
+      pos_++;
+
+      if (!number(value))
+      {
+        return fail("expected a number");
+      }
+
+      return Selection::NodePtr(new CompareNode(axis, op, value));
+    }
+
+    if (accept("within"))
+    {
+      double radius;
+
+      if (!number(radius) || radius < 0)
+      {
+        return fail("expected a distance after 'within'");
+      }
+
+      if (!accept("of") || !isWord(pos_))
+      {
+        return fail("expected 'of NAME' after the distance");
+      }
+
+      const std::string& ref = tokens_[pos_++];
+
+      if (std::find(references_.begin(), references_.end(), ref) ==
+          references_.end())
+      {
+        references_.push_back(ref);
+      }
+
+      return Selection::NodePtr(new WithinNode(radius, ref));
+    }
+
+    return fail("unexpected '" + tokens_[pos_] + "'");
+  }
+
+  bool accept(const char* token)
+  {
+    if (pos_ < tokens_.size() && tokens_[pos_] == token)
+    {
+      pos_++;
+      return true;
+    }
+    return false;
+  }
+
+  bool isWord(size_t i) const
+  {
+    return i < tokens_.size() && !isKeyword(tokens_[i]) &&
+           !isOperator(tokens_[i]);
+  }
+
+  bool number(double& value)
+  {
+    if (pos_ >= tokens_.size())
+    {
+      return false;
+    }
+
+    const char* s = tokens_[pos_].c_str();
+    char* end;
+    value = strtod(s, &end);
+
+    if (end == s || *end)
+    {
+      return false;
+    }
+
+    pos_++;
+    return true;
+  }
+
+  static bool comparison(const std::string& t, CompareNode::Op& op)
+  {
+    if (t == "<") op = CompareNode::LT;
+    else if (t == "<=") op = CompareNode::LE;
+    else if (t == ">") op = CompareNode::GT;
+    else if (t == ">=") op = CompareNode::GE;
+    else if (t == "==") op = CompareNode::EQ;
+    else if (t == "!=") op = CompareNode::NE;
+    else return false;
+    return true;
+  }
+
+  Selection::NodePtr fail(const std::string& msg)
+  {
+    if (error_.empty())
+    {
+      error_ = msg;
+    }
+    return Selection::NodePtr();
+  }
+
+  static const int MAX_DEPTH = 256;
+
+  const std::vector<std::string>& tokens_;
+  size_t pos_;
+  int depth_;
+  std::vector<std::string>& references_;
+  std::string error_;
+};
+}  // namespace
+
+Selection::Selection()
+{
+}
+
+bool Selection::compile(const std::string& expr)
+{
+  std::vector<std::string> tokens;
+  tokenize(expr, tokens);
+
+  references_.clear();
+  bound_.clear();
+  error_.clear();
+
+  Parser parser(tokens, references_);
+  root_ = parser.parse();
+
+  if (!root_)
+  {
+    error_ = parser.error();
+    references_.clear();
+    return false;
+  }
+
+  return true;
+}
+
+const std::vector<std::string>& Selection::references() const
+{
+  return references_;
+}
+
+void Selection::bind(const std::string& name, AtomContainer::Ptr ac)
+{
+  bound_[name] = ac;
+}
+
+void Selection::evaluate(const AtomContainer& ac, std::vector<size_t>& rows) const
+{
+  rows.clear();
+
+  if (!root_)
+  {
+    return;
+  }
+
+  std::vector<char> active(ac.size(), 1);
+  std::vector<char> out(ac.size(), 0);
+
+  root_->eval(ac, bound_, active, out);
+
+  for (size_t i = 0; i < out.size(); i++)
+  {
+    if (out[i])
+    {
+      rows.push_back(i);
+    }
+  }
+}
+
+const std::string& Selection::error() const
+{
+  return error_;
+}
@@ -0,0 +1,89 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      selection.h
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef SELECTION_H
+#define SELECTION_H
+
+#include "atomcontainer.h"
+#include <boost/shared_ptr.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Atom selection expressions, compiled once into a predicate tree and then
+ * evaluated over whole containers. Grammar:
+ *
+ *   expr    := term { "or" term }
+ *   term    := factor { "and" factor }
+ *   factor  := "not" factor | "(" expr ")" | clause
+ *   clause  := "all" | "none"
+ *            | "type" WORD { ["or"] WORD }     exact type match
+ *            | "name" WORD { ["or"] WORD }     fnmatch wildcards
+ *            | ("x" | "y" | "z") CMP NUMBER    CMP is < <= > >= == !=
+ *            | "within" NUMBER "of" WORD       distance to a named container
+ *
+ * so "type C or N and within 6.0 of ligand and z > 10" keeps carbons and
+ * nitrogens near the container bound to "ligand" above the z = 10 plane.
+ */
+class Selection
+{
+public:
+  typedef boost::shared_ptr<Selection> Ptr;
+
+  class Node;
+  typedef boost::shared_ptr<Node> NodePtr;
+
+  Selection();
+
+  /**
+   * @brief Parse an expression, replacing any previous one
+   * @param expr Selection expression
+   * @return true on success, see error() otherwise
+   */
+  bool compile(const std::string& expr);
+
+  /**
+   * @brief Container names used by "within" clauses, each must be bound
+   *        before evaluating
+   */
+  const std::vector<std::string>& references() const;
+
+  /**
+   * @brief Bind a container to a name used in a "within" clause
+   * @param name Reference name
+   * @param ac Container, a null pointer matches nothing
+   */
+  void bind(const std::string& name, AtomContainer::Ptr ac);
+
+  /**
+   * @brief Find the rows of a container matching the expression
+   * @param[in] ac Container to test
+   * @param[out] rows Matching row indices, ascending
+   */
+  void evaluate(const AtomContainer& ac, std::vector<size_t>& rows) const;
+
+  /**
+   * @brief Description of the last compile failure
+   */
+  const std::string& error() const;
+
+private:
+  NodePtr root_;
+  std::vector<std::string> references_;
+  std::map<std::string, AtomContainer::Ptr> bound_;
+  std::string error_;
+};
+
+#endif // SELECTION_H
@@ -0,0 +1,288 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      textscan.h
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef TEXTSCAN_H
+#define TEXTSCAN_H
+
+#include <boost/cstdint.hpp>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+// Helpers for scanning text held in memory (see MappedFile). These work on
+// [p, end) ranges, advance p past what they consume and only allocate for
+// numbers of 128 characters or more.
+// They are inline since they run once per token of large files.
+namespace TextScan
+{
+  inline bool isSpace(char c)
+  {
+    return c == ' ' || c == '\t' || c == '\r';
+  }
+
+  inline bool isDigit(char c)
+  {
+    return c >= '0' && c <= '9';
+  }
+
+  /**
+   * @brief Skip spaces and tabs, stops at newlines
+   */
+  inline void skipSpace(const char*& p, const char* end)
+  {
+    while (p < end && isSpace(*p))
+    {
+      p++;
+    }
+  }
+
+  /**
+   * @brief Move p to the start of the next line
+   * @return false if there is no next line
+   */
+  inline bool nextLine(const char*& p, const char* end)
+  {
+    const char* nl = (const char*)memchr(p, '\n', end - p);
+
+    if (!nl)
+    {
+      p = end;
+      return false;
+    }
+
+    p = nl + 1;
+    return true;
+  }
+
+  /**
+   * @brief End of the line starting at p, excluding the newline
+   */
+  inline const char* lineEnd(const char* p, const char* end)
+  {
+    const char* nl = (const char*)memchr(p, '\n', end - p);
+    return nl ? nl : end;
+  }
+
+  /**
+   * @brief Read a whitespace separated token on the current line
+   * @param[in,out] p Read position
+   * @param[in] end End of text
+   * @param[out] tok Start of token
+   * @param[out] len Length of token
+   * @return false if the line has no more tokens
+   */
+  inline bool token(const char*& p, const char* end, const char*& tok, size_t& len)
+  {
+    skipSpace(p, end);
+    tok = p;
+
+    while (p < end && !isSpace(*p) && *p != '\n')
+    {
+      p++;
+    }
+
+    len = p - tok;
+    return len > 0;
+  }
+
+  /**
+   * @brief Read a decimal integer on the current line, fails if it does not
+   *        fit a long
+   */
+  inline bool parseLong(const char*& p, const char* end, long& v)
+  {
+    skipSpace(p, end);
+
+    const char* q = p;
+    bool neg = false;
+
+    if (q < end && (*q == '-' || *q == '+'))
+    {
+      neg = *q == '-';
+      q++;
+    }
+
+    if (q == end || !isDigit(*q))
+    {
+      return false;
+    }
+
+    long n = 0;
+
+    while (q < end && isDigit(*q))
+    {
+      const long d = *q - '0';
+
+      // reject values that do not fit rather than wrapping
+      if (n > (LONG_MAX - d) / 10)
+      {
+        return false;
+      }
+
+      n = n * 10 + d;
+      q++;
+    }
+
+    if (q < end && !isSpace(*q) && *q != '\n')
+    {
+      return false;
+    }
+
+    v = neg ? -n : n;
+    p = q;
+    return true;
+  }
+
+  /**
+   * @brief Read a floating point number on the current line. Numbers with
+   *        up to 15 significant digits and small exponents (typical of
+   *        coordinates) are converted exactly without leaving this function,
+   *        others go through strtod.
+   */
+  inline bool parseDouble(const char*& p, const char* end, double& v)
+  {
+    // powers of ten that are exact in a double
+    static const double pow10[] =
+    {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    skipSpace(p, end);
+
+    const char* q = p;
+    bool neg = false;
+
+    if (q < end && (*q == '-' || *q == '+'))
+    {
+      neg = *q == '-';
+      q++;
+    }
+
+    boost::uint64_t m = 0;
+    int digits = 0;  // significant digits held in m
+    int exp10 = 0;
+    bool any = false;
+    bool exact = true;
+
+    for (; q < end && isDigit(*q); q++)
+    {
+      any = true;
+
+      if (digits < 19)
+      {
+        m = m * 10 + (*q - '0');
+        digits += m > 0;
+      }
+      else
+      {
+        exp10++;
+        exact = exact && *q == '0';
+      }
+    }
+
+    if (q < end && *q == '.')
+    {
+      for (q++; q < end && isDigit(*q); q++)
+      {
+        any = true;
+
+        if (digits < 19)
+        {
+          m = m * 10 + (*q - '0');
+          digits += m > 0;
+          exp10--;
+        }
+        else
+        {
+          exact = exact && *q == '0';
+        }
+      }
+    }
+
+    if (!any)
+    {
+      return false;
+    }
+
+    if (q < end && (*q == 'e' || *q == 'E'))
+    {
+      const char* e = q + 1;
+      bool eneg = false;
+
+      if (e < end && (*e == '-' || *e == '+'))
+      {
+        eneg = *e == '-';
+        e++;
+      }
+
+      if (e == end || !isDigit(*e))
+      {
+        return false;
+      }
+
+      int ev = 0;
+
+      for (; e < end && isDigit(*e); e++)
+      {
+        ev = ev < 100000 ? ev * 10 + (*e - '0') : ev;
+      }
+
+      exp10 += eneg ? -ev : ev;
+      q = e;
+    }
+
+    if (q < end && !isSpace(*q) && *q != '\n')
+    {
+      return false;
+    }
+
+    if (exact && m < (1ULL << 53) && exp10 >= -22 && exp10 <= 22)
+    {
+      // both m and the power of ten are exact so the result is correctly rounded
+      v = exp10 < 0 ? m / pow10[-exp10] : m * pow10[exp10];
+    }
+    else
+    {
+      // strtod needs a terminated copy, long tokens go to the heap
+      char buf[128];
+      const size_t len = q - p;
+
+      if (len < sizeof(buf))
+      {
+        memcpy(buf, p, len);
+        buf[len] = 0;
+        v = strtod(buf, 0);
+      }
+      else
+      {
+        v = strtod(std::string(p, q).c_str(), 0);
+      }
+
+      p = q;
+      return true;
+    }
+
+    if (neg)
+    {
+      v = -v;
+    }
+
+    p = q;
+    return true;
+  }
+}  // namespace TextScan
+
+#endif // TEXTSCAN_H
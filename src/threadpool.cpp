@@ -0,0 +1,178 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      threadpool.cpp
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include "threadpool.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+struct ThreadPool::Job
+{
+  Job(size_t count, const boost::function<void (size_t)>& func)
+    : n(count), f(func), next(0), failed(false), done(0)
+  {
+  }
+
+  const size_t n;
+  const boost::function<void (size_t)> f;
+  std::atomic<size_t> next;  // next index to hand out
+  std::atomic<bool> failed;  // set once f threw, later indices are skipped
+  size_t done;  // indices finished, guarded by mutex
+  std::exception_ptr error;  // first exception thrown by f, guarded by mutex
+  std::mutex mutex;
+  std::condition_variable finished;
+};
+
+ThreadPool& ThreadPool::shared()
+{
+  static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+  return pool;
+}
+
+ThreadPool::ThreadPool(size_t threads)
+  : stop_(false)
+{
+  for (size_t i = 0; i < threads; i++)
+  {
+    threads_.push_back(std::thread(&ThreadPool::work, this));
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+
+  for (size_t i = 0; i < threads_.size(); i++)
+  {
+    threads_[i].join();
+  }
+}
+
+size_t ThreadPool::concurrency() const
+{
+  return threads_.size() + 1;
+}
+
+void ThreadPool::parallelFor(size_t n, const boost::function<void (size_t)>& f)
+{
+  if (n == 0)
+  {
+    return;
+  }
+
+  boost::shared_ptr<Job> job(new Job(n, f));
+
+  if (n > 1 && !threads_.empty())
+  {
+    // one entry per worker that could help, late entries find no work left
+    const size_t helpers = std::min(n - 1, threads_.size());
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+
+      for (size_t i = 0; i < helpers; i++)
+      {
+        queue_.push_back(job);
+      }
+    }
+    wake_.notify_all();
+  }
+
+  run(job);
+
+  // wait for indices claimed by other threads
+  std::unique_lock<std::mutex> lock(job->mutex);
+
+  while (job->done < job->n)
+  {
+    job->finished.wait(lock);
+  }
+
+  // no other thread touches f any more, safe to unwind the caller
+  if (job->error)
+  {
+    std::rethrow_exception(job->error);
+  }
+}
+
+void ThreadPool::work()
+{
+  while (true)
+  {
+    boost::shared_ptr<Job> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+
+      while (!stop_ && queue_.empty())
+      {
+        wake_.wait(lock);
+      }
+
+      if (stop_ && queue_.empty())
+      {
+        return;
+      }
+
+      job = queue_.front();
+      queue_.pop_front();
+    }
+
+    run(job);
+  }
+}
+
+void ThreadPool::run(boost::shared_ptr<Job> job)
+{
+  size_t finished = 0;
+
+  // after a failure indices are still claimed and counted so the caller's
+  // wait ends, but f is no longer run
+  for (size_t i = job->next++; i < job->n; i = job->next++)
+  {
+    if (!job->failed)
+    {
+      try
+      {
+        job->f(i);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(job->mutex);
+
+        if (!job->error)
+        {
+          job->error = std::current_exception();
+        }
+
+        job->failed = true;
+      }
+    }
+
+    finished++;
+  }
+
+  if (finished)
+  {
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->done += finished;
+
+    if (job->done == job->n)
+    {
+      job->finished.notify_all();
+    }
+  }
+}
@@ -0,0 +1,75 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      threadpool.h
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of worker threads running indexed jobs. The calling thread
+ * takes part in its own jobs so a job started from inside a worker (a
+ * nested parallelFor) always makes progress.
+ */
+class ThreadPool
+{
+public:
+  /**
+   * @brief Process wide pool with one thread per hardware thread
+   */
+  static ThreadPool& shared();
+
+  /**
+   * @brief Start a pool
+   * @param threads Number of worker threads, the caller of parallelFor
+   *        is an additional thread
+   */
+  explicit ThreadPool(size_t threads);
+  ~ThreadPool();
+
+  /**
+   * @brief Number of threads that can work on a job, including the caller
+   */
+  size_t concurrency() const;
+
+  /**
+   * @brief Run f(i) for every i in [0, n) and wait for all of them. Indices
+   *        are handed out one at a time so uneven jobs balance themselves.
+   * @param n Number of indices
+   * @param f Function to run, must be safe to call concurrently
+   * @throw the first exception thrown by f, rethrown once every thread has
+   *        left f. Indices not yet started when it was thrown are skipped.
+   */
+  void parallelFor(size_t n, const boost::function<void (size_t)>& f);
+
+private:
+  struct Job;
+
+  void work();
+  static void run(boost::shared_ptr<Job> job);
+
+  std::vector<std::thread> threads_;
+  std::deque<boost::shared_ptr<Job> > queue_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stop_;
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,421 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      trajectory.cpp
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include "trajectory.h"
+#include "threadpool.h"
+#include "xyz.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <stdio.h>
+#include <sys/stat.h>
+
+// batches waiting between two stages, bounds the memory in flight
+static const size_t QUEUE_DEPTH = 2;
+
+// frames per batch, fixed rather than scaled with the thread count so the
+// memory used doesn't grow with the machine. At most 2 * QUEUE_DEPTH + 3
+// batches exist at once (one being read, one being aligned, one being
+// written and the two queues), i.e. 448 frames.
+static const size_t BATCH_FRAMES = 64;
+
+namespace
+{
+struct Frame
+{
+  AtomContainer ac;
+  std::string comment;
+  double diff;
+};
+
+struct Batch
+{
+  std::vector<Frame> frames;
+  size_t count;  // frames in use, frames are reused between batches
+};
+
+typedef boost::shared_ptr<Batch> BatchPtr;
+
+// hands batches from one stage to the next, blocking when full or empty
+class BatchQueue
+{
+public:
+  BatchQueue() : closed_(false) {}
+
+  // false if the queue was closed, the batch is dropped
+  bool push(const BatchPtr& batch)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!closed_ && queue_.size() >= QUEUE_DEPTH)
+    {
+      changed_.wait(lock);
+    }
+
+    if (closed_)
+    {
+      return false;
+    }
+
+    queue_.push_back(batch);
+    changed_.notify_all();
+    return true;
+  }
+
+  // false once the queue is closed and drained
+  bool pop(BatchPtr& batch)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!closed_ && queue_.empty())
+    {
+      changed_.wait(lock);
+    }
+
+    if (queue_.empty())
+    {
+      return false;
+    }
+
+    batch = queue_.front();
+    queue_.pop_front();
+    changed_.notify_all();
+    return true;
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    changed_.notify_all();
+  }
+
+private:
+  std::deque<BatchPtr> queue_;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  bool closed_;
+};
+
+// batches that finished writing are handed back to the reader
+class BatchPool
+{
+public:
+  BatchPtr get(size_t size)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+
+      if (!free_.empty())
+      {
+        BatchPtr batch = free_.back();
+        free_.pop_back();
+        return batch;
+      }
+    }
+
+    BatchPtr batch(new Batch);
+    batch->frames.resize(size);
+    batch->count = 0;
+    return batch;
+  }
+
+  void put(const BatchPtr& batch)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(batch);
+  }
+
+private:
+  std::vector<BatchPtr> free_;
+  std::mutex mutex_;
+};
+
+void readFrames(XYZReader* reader, size_t batch_size, BatchPool* pool,
+                BatchQueue* out, std::string* error)
+{
+  // an escaping exception would terminate the process, report it instead
+  try
+  {
+    while (true)
+    {
+      BatchPtr batch = pool->get(batch_size);
+      batch->count = 0;
+
+      while (batch->count < batch->frames.size())
+      {
+        Frame& frame = batch->frames[batch->count];
+
+        if (!reader->next(frame.ac, frame.comment))
+        {
+          break;
+        }
+
+        batch->count++;
+      }
+
+      if (batch->count < batch->frames.size())
+      {
+        *error = reader->error();
+      }
+
+      // the consumer closes the queue early when it gives up
+      if ((batch->count && !out->push(batch)) ||
+          batch->count < batch->frames.size())
+      {
+        break;
+      }
+    }
+  }
+  catch (const std::exception& e)
+  {
+    *error = std::string("reading trajectory failed: ") + e.what();
+  }
+
+  out->close();
+}
+
+void writeFrames(XYZWriter* writer, BatchQueue* in, BatchPool* pool,
+                 std::vector<double>* residuals, std::string* error,
+                 std::atomic<bool>* failed)
+{
+  try
+  {
+    BatchPtr batch;
+
+    while (in->pop(batch))
+    {
+      for (size_t i = 0; i < batch->count; i++)
+      {
+        const Frame& frame = batch->frames[i];
+        residuals->push_back(frame.diff);
+
+        // keep draining after a failure so the other stages can finish
+        if (writer && !*failed && !writer->write(frame.ac, frame.comment))
+        {
+          *error = writer->error();
+          *failed = true;
+        }
+      }
+
+      pool->put(batch);
+    }
+  }
+  catch (const std::exception& e)
+  {
+    *error = std::string("writing trajectory failed: ") + e.what();
+    *failed = true;
+
+    // nothing drains the queue any more, make pushes return instead of block
+    in->close();
+  }
+}
+
+// true if both paths name the same existing file
+bool sameFile(const std::string& a, const std::string& b)
+{
+  struct stat sa;
+  struct stat sb;
+
+  return stat(a.c_str(), &sa) == 0 && stat(b.c_str(), &sb) == 0 &&
+         sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+// closed form fit of row i onto row i, returns the sum of squared distances
+double fitByIndex(AtomContainer& ac, const AtomContainer& reference)
+{
+  double dx, dy, dz, rx, ry, rz, rmsd;
+
+  if (!AtomContainer::alignByIndex(ac, reference, dx, dy, dz, rx, ry, rz, rmsd))
+  {
+    return 0;
+  }
+
+  ac.transform(dx, dy, dz, rx, ry, rz);
+  return rmsd * rmsd * ac.size();
+}
+
+struct AlignTask
+{
+  void operator()(size_t i) const
+  {
+    Frame& frame = batch->frames[i];
+
+    if (mode == TrajectoryAligner::BY_INDEX)
+    {
+      frame.diff = fitByIndex(frame.ac, *reference);
+      return;
+    }
+
+    // the session only borrows the frame, it is not deleted
+    AtomContainer::Ptr ac(&frame.ac, NoDelete());
+    Alignment session(ac, reference);
+
+    Alignment::Params X = *X0;
+    frame.diff = session.minimize(X, method, rho_begin, rho_end, steps);
+    frame.ac.transform(X(0), X(1), X(2), X(3), X(4), X(5));
+  }
+
+  struct NoDelete
+  {
+    void operator()(AtomContainer*) const {}
+  };
+
+  Batch* batch;
+  TrajectoryAligner::Mode mode;
+  AtomContainer::Ptr reference;
+  const Alignment::Params* X0;
+  AtomContainer::AlignMethod method;
+  double rho_begin;
+  double rho_end;
+  int steps;
+};
+}  // namespace
+
+TrajectoryAligner::TrajectoryAligner(AtomContainer::Ptr reference)
+  : reference_(reference)
+{
+}
+
+bool TrajectoryAligner::run(const std::string& in_path, const std::string& out_path,
+                            Mode mode, const Alignment::Params& X0,
+                            AtomContainer::AlignMethod method,
+                            double rho_begin, double rho_end, int steps,
+                            std::vector<double>& residuals)
+{
+  error_.clear();
+  residuals.clear();
+
+  XYZReader reader;
+
+  if (!reader.open(in_path))
+  {
+    error_ = reader.error();
+    return false;
+  }
+
+  // the input is memory mapped, truncating it for output would pull the
+  // pages from under the reader
+  if (!out_path.empty() && sameFile(in_path, out_path))
+  {
+    error_ = out_path + ": output would overwrite the input trajectory";
+    return false;
+  }
+
+  XYZWriter writer;
+
+  if (!out_path.empty() && !writer.open(out_path))
+  {
+    error_ = writer.error();
+    return false;
+  }
+
+  // shared structures of the reference are built before the threads start
+  reference_->kdTree();
+
+  BatchPool pool;
+  BatchQueue aligned;
+  BatchQueue parsed;
+  std::string read_error;
+  std::string write_error;
+  std::atomic<bool> write_failed(false);
+
+  std::thread read_thread(readFrames, &reader, BATCH_FRAMES, &pool, &parsed,
+                          &read_error);
+  std::thread write_thread(writeFrames, out_path.empty() ? 0 : &writer,
+                           &aligned, &pool, &residuals, &write_error,
+                           &write_failed);
+
+  AlignTask task;
+  task.mode = mode;
+  task.reference = reference_;
+  task.X0 = &X0;
+  task.method = method;
+  task.rho_begin = rho_begin;
+  task.rho_end = rho_end;
+  task.steps = steps;
+
+  BatchPtr batch;
+  size_t first = 0;  // index of the first frame of the batch
+
+  // the threads must be joined however this loop ends
+  try
+  {
+    while (parsed.pop(batch))
+    {
+      // after a failure stop the reader and drain what it already queued
+      if (!error_.empty() || write_failed)
+      {
+        parsed.close();
+        continue;
+      }
+
+      if (mode == BY_INDEX)
+      {
+        for (size_t i = 0; i < batch->count; i++)
+        {
+          if (batch->frames[i].ac.size() != reference_->size())
+          {
+            char msg[128];
+            snprintf(msg, sizeof(msg), ": frame %lu has %lu atoms, reference has %lu",
+                     (unsigned long)(first + i + 1),
+                     (unsigned long)batch->frames[i].ac.size(),
+                     (unsigned long)reference_->size());
+            error_ = in_path + msg;
+
+            // frames before the bad one are still aligned and written
+            batch->count = i;
+            parsed.close();
+            break;
+          }
+        }
+      }
+
+      task.batch = batch.get();
+      ThreadPool::shared().parallelFor(batch->count, task);
+
+      first += batch->count;
+      aligned.push(batch);
+    }
+  }
+  catch (const std::exception& e)
+  {
+    error_ = std::string("aligning trajectory failed: ") + e.what();
+    parsed.close();
+  }
+
+  aligned.close();
+  read_thread.join();
+  write_thread.join();
+
+  if (!out_path.empty() && !writer.close() && write_error.empty())
+  {
+    write_error = writer.error();
+  }
+
+  if (error_.empty())
+  {
+    error_ = !read_error.empty() ? read_error : write_error;
+  }
+
+  return error_.empty();
+}
+
+const std::string& TrajectoryAligner::error() const
+{
+  return error_;
+}
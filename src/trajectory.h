@@ -0,0 +1,85 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      trajectory.h
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <boost/shared_ptr.hpp>
+#include "alignment.h"
+#include "atomcontainer.h"
+#include <string>
+#include <vector>
+
+/**
+ * Superimposes every frame of a multi-frame XYZ file onto a reference
+ * without holding the trajectory in memory. Frames flow through three
+ * stages running at the same time: a reader thread parses batches of
+ * frames, the calling thread aligns each batch on the shared thread pool
+ * and a writer thread writes the aligned frames in their original order.
+ * Batches hold 64 frames and at most 7 are in flight at once, so memory
+ * is bounded by the frame size, not by the length of the trajectory or
+ * the number of threads.
+ */
+class TrajectoryAligner
+{
+public:
+  typedef boost::shared_ptr<TrajectoryAligner> Ptr;
+
+  /**
+   * @brief How frames are fitted to the reference
+   */
+  enum Mode
+  {
+    BY_INDEX,  // closed form fit pairing row i of a frame with row i of the reference
+    NEAREST  // align() style search pairing atoms by nearest neighbour
+  };
+
+  /**
+   * @brief Prepare a reference
+   * @param reference Container frames are aligned onto, it must not be
+   *        modified while run() is active
+   */
+  explicit TrajectoryAligner(AtomContainer::Ptr reference);
+
+  /**
+   * @brief Align every frame of a trajectory
+   * @param[in] in_path Multi-frame XYZ file to read
+   * @param[in] out_path XYZ file receiving the aligned frames, nothing is
+   *            written if empty
+   * @param[in] mode Fit used for each frame
+   * @param[in] X0 starting transform for NEAREST
+   * @param[in] method,rho_begin,rho_end,steps local alignment settings for
+   *            NEAREST
+   * @param[out] residuals one value per frame: the sum of squared pair
+   *             distances for BY_INDEX, the alignment objective for NEAREST
+   * @return true on success, see error() otherwise. Frames processed before
+   *         a failure are written and have residuals.
+   */
+  bool run(const std::string& in_path, const std::string& out_path,
+           Mode mode, const Alignment::Params& X0,
+           AtomContainer::AlignMethod method,
+           double rho_begin, double rho_end, int steps,
+           std::vector<double>& residuals);
+
+  /**
+   * @brief Description of the last failure
+   */
+  const std::string& error() const;
+
+private:
+  AtomContainer::Ptr reference_;
+  std::string error_;
+};
+
+#endif // TRAJECTORY_H
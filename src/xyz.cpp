@@ -0,0 +1,247 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      xyz.cpp
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#include "xyz.h"
+#include "textscan.h"
+#include <algorithm>
+#include <errno.h>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+
+XYZReader::XYZReader()
+  : pos_(0), line_(0), frames_(0)
+{
+}
+
+bool XYZReader::open(const std::string& path)
+{
+  path_ = path;
+  line_ = 0;
+  frames_ = 0;
+  error_.clear();
+
+  if (!file_.open(path))
+  {
+    error_ = file_.error();
+    return false;
+  }
+
+  pos_ = file_.begin();
+  return true;
+}
+
+bool XYZReader::next(AtomContainer& ac, std::string& comment)
+{
+  using namespace TextScan;
+
+  const char* end = file_.end();
+
+  ac.clear();
+  error_.clear();
+
+  // skip blank lines between frames
+  while (pos_ < end)
+  {
+    const char* p = pos_;
+    skipSpace(p, end);
+
+    if (p < end && *p != '\n')
+    {
+      break;
+    }
+
+    line_++;
+    nextLine(pos_, end);
+  }
+
+  if (pos_ >= end)
+  {
+    return false;
+  }
+
+  long count;
+
+  if (!parseLong(pos_, end, count) || count < 0)
+  {
+    return fail("expected atom count");
+  }
+
+  line_++;
+  nextLine(pos_, end);
+
+  if (pos_ >= end)
+  {
+    return fail("missing comment line");
+  }
+
+  const char* comment_end = lineEnd(pos_, end);
+  comment.assign(pos_, comment_end);
+
+  line_++;
+  nextLine(pos_, end);
+
+  // the count is untrusted, an atom line takes at least 8 bytes ("C 0 0 0\n")
+  // so never reserve more than the rest of the file can hold. A short file
+  // is reported by the line parsing below.
+  ac.reserve(std::min<size_t>(count, (end - pos_) / 8));
+
+  std::map<std::string, int> names;  // for keeping track of H3, O4, C1 etc
+  std::string type;
+  char suffix[32];
+
+  for (long i = 0; i < count; i++)
+  {
+    if (pos_ >= end)
+    {
+      return fail("unexpected end of file");
+    }
+
+    const char* tok;
+    size_t len;
+    double x, y, z;
+
+    if (!token(pos_, end, tok, len) ||
+        !parseDouble(pos_, end, x) ||
+        !parseDouble(pos_, end, y) ||
+        !parseDouble(pos_, end, z))
+    {
+      return fail("expected `type x y z'");
+    }
+
+    type.assign(tok, len);
+
+    snprintf(suffix, sizeof(suffix), "%i", ++names[type]);
+    ac.add(type, type + suffix, x, y, z);
+
+    line_++;
+    nextLine(pos_, end);
+  }
+
+  frames_++;
+  return true;
+}
+
+size_t XYZReader::frames() const
+{
+  return frames_;
+}
+
+const std::string& XYZReader::error() const
+{
+  return error_;
+}
+
+bool XYZReader::fail(const std::string& msg)
+{
+  char where[64];
+  snprintf(where, sizeof(where), ":%lu: ", (unsigned long)(line_ + 1));
+  error_ = path_ + where + msg;
+  pos_ = file_.end();
+  return false;
+}
+
+XYZWriter::XYZWriter()
+  : file_(0)
+{
+}
+
+XYZWriter::~XYZWriter()
+{
+  close();
+}
+
+bool XYZWriter::open(const std::string& path)
+{
+  close();
+
+  path_ = path;
+  error_.clear();
+  file_ = fopen(path.c_str(), "w");
+
+  if (!file_)
+  {
+    return fail(strerror(errno));
+  }
+
+  // frames are written line by line, a large buffer keeps that cheap
+  setvbuf(file_, 0, _IOFBF, 1 << 20);
+  return true;
+}
+
+bool XYZWriter::write(const AtomContainer& ac, const std::string& comment)
+{
+  if (!file_)
+  {
+    return fail("file is not open");
+  }
+
+  std::string line(comment);
+
+  for (size_t i = 0; i < line.size(); i++)
+  {
+    if (line[i] == '\n' || line[i] == '\r')
+    {
+      line[i] = ' ';
+    }
+  }
+
+  fprintf(file_, "%lu\n%s\n", (unsigned long)ac.size(), line.c_str());
+
+  const std::vector<std::string>& types = ac.types();
+  const std::vector<double>& x = ac.x();
+  const std::vector<double>& y = ac.y();
+  const std::vector<double>& z = ac.z();
+
+  for (size_t i = 0; i < ac.size(); i++)
+  {
+    fprintf(file_, "%s %.6f %.6f %.6f\n", types[i].c_str(), x[i], y[i], z[i]);
+  }
+
+  if (ferror(file_))
+  {
+    return fail(strerror(errno));
+  }
+
+  return true;
+}
+
+bool XYZWriter::close()
+{
+  if (!file_)
+  {
+    return true;
+  }
+
+  const bool ok = fclose(file_) == 0;
+  file_ = 0;
+
+  if (!ok)
+  {
+    return fail(strerror(errno));
+  }
+
+  return true;
+}
+
+const std::string& XYZWriter::error() const
+{
+  return error_;
+}
+
+bool XYZWriter::fail(const std::string& msg)
+{
+  error_ = path_ + ": " + msg;
+  return false;
+}
@@ -0,0 +1,117 @@
+/**
+ * Software License Agreement CC0
+ *
+ * \file      xyz.h
+ * \author    Jason Mercer <jason.mercer@gmail.com>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see http://creativecommons.org/publicdomain/zero/1.0/
+ */
+
+#ifndef XYZ_H
+#define XYZ_H
+
+#include "atomcontainer.h"
+#include "mappedfile.h"
+#include <string>
+#include <stdio.h>
+
+/**
+ * Reads XYZ files frame by frame. Each frame is an atom count line, a
+ * comment line and one "type x y z" line per atom. Files with several
+ * frames (trajectories) are read one frame per call to next().
+ */
+class XYZReader
+{
+public:
+  XYZReader();
+
+  /**
+   * @brief Open a file for reading
+   * @param path File name
+   * @return true on success, see error() otherwise
+   */
+  bool open(const std::string& path);
+
+  /**
+   * @brief Read the next frame. Atoms are named by type and a per type
+   *        count (C1, C2, H1, ...).
+   * @param[out] ac Container to fill, it is cleared first
+   * @param[out] comment Comment line of the frame
+   * @return false at the end of the file or on a parse error, error() is
+   *         empty in the first case
+   */
+  bool next(AtomContainer& ac, std::string& comment);
+
+  /**
+   * @brief Number of frames read so far
+   */
+  size_t frames() const;
+
+  /**
+   * @brief Description of the last failure
+   */
+  const std::string& error() const;
+
+private:
+  bool fail(const std::string& msg);
+
+  MappedFile file_;
+  std::string path_;
+  const char* pos_;
+  size_t line_;
+  size_t frames_;
+  std::string error_;
+};
+
+/**
+ * Writes XYZ frames, one "type x y z" line per atom.
+ */
+class XYZWriter
+{
+public:
+  XYZWriter();
+  ~XYZWriter();
+
+  /**
+   * @brief Create or truncate a file for writing
+   * @param path File name
+   * @return true on success, see error() otherwise
+   */
+  bool open(const std::string& path);
+
+  /**
+   * @brief Append a frame
+   * @param ac Atoms to write
+   * @param comment Comment line, newlines are replaced with spaces
+   * @return false on a write failure
+   */
+  bool write(const AtomContainer& ac, const std::string& comment);
+
+  /**
+   * @brief Flush and close the file
+   * @return false if buffered data could not be written
+   */
+  bool close();
+
+  /**
+   * @brief Description of the last failure
+   */
+  const std::string& error() const;
+
+private:
+  XYZWriter(const XYZWriter&);
+  XYZWriter& operator=(const XYZWriter&);
+
+  bool fail(const std::string& msg);
+
+  FILE* file_;
+  std::string path_;
+  std::string error_;
+};
+
+#endif // XYZ_H